@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../include-shared/bit_vector.hpp"
+#include "../include-shared/circuit.hpp"
+#include "../include-shared/compiled_circuit.hpp"
+#include "../include-shared/constants.hpp"
+#include "../include-shared/messages.hpp"
+#include "../include-shared/prg.hpp"
+#include "../include/drivers/crypto_driver.hpp"
+#include "../include/drivers/share_driver.hpp"
+#include "../include/pkg/loopback.hpp"
+
+/*
+ * Usage: ./gmw_bench [--json <file>] [circuit directory] [port]
+ *
+ * Times every primitive on the protocol's hot path and writes one JSON array
+ * with the operation count, seconds, ns/op and ops/s of each, to the given
+ * file or else to stdout (the drivers log to stderr):
+ *
+ *   parse_circuit        once per circuit in the directory (default circuits)
+ *   encrypt_and_tag,     AEAD session messages of 16 B to 64 KiB
+ *   decrypt_and_verify
+ *   DH_initialize        keypairs from the pool, refilled as it is drained
+ *   OT_send/OT_recv      single base OTs and a batch, over a loopback socket
+ *   OT_extension         derandomized 1-out-of-4 OTs on bits, as AND gates use
+ *   generate_random_shares
+ *   evaluate_plaintext   every gate of each circuit over 64 instances, with
+ *                        ANDs on shares computed locally
+ *
+ * Each result is on its own line, so runs can be diffed or grepped as well as
+ * parsed.
+ */
+namespace
+{
+  struct Result
+  {
+    std::string name;
+    long long ops;
+    double seconds;
+  };
+  std::vector<Result> results;
+
+  // Times one call of f, which runs ops operations.
+  template <typename F>
+  void time_once(const std::string &name, long long ops, F f)
+  {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    results.push_back({name, ops, seconds});
+  }
+
+  // Calls f, which runs ops_per_call operations, until min_seconds pass.
+  template <typename F>
+  void time_repeated(const std::string &name, long long ops_per_call, F f, double min_seconds = 0.5)
+  {
+    auto start = std::chrono::steady_clock::now();
+    long long calls = 0;
+    double seconds = 0;
+    do
+    {
+      f();
+      calls++;
+      seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (seconds < min_seconds);
+    results.push_back({name, calls * ops_per_call, seconds});
+  }
+
+  void print_results(std::ostream &out)
+  {
+    out << "[" << std::endl;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+      const Result &r = results[i];
+      out << "  {\"name\": \"" << r.name << "\", \"ops\": " << r.ops
+          << ", \"seconds\": " << r.seconds
+          << ", \"ns_per_op\": " << r.seconds * 1e9 / r.ops
+          << ", \"ops_per_sec\": " << r.ops / r.seconds << "}"
+          << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    out << "]" << std::endl;
+  }
+
+  /*
+   * Evaluate every gate of a compiled circuit in plaintext on all instances,
+   * the way participant evaluates local gates, with ANDs computed in place.
+   */
+  void evaluate_plaintext(const CompiledCircuit &circuit, WireShares &shares)
+  {
+    for (int d = 0; d < circuit.num_layers; d++)
+    {
+      const CircuitLayer &layer = circuit.layers[d];
+      for (const GateRun &run : find_gate_runs(circuit.gates, layer.local_begin, layer.and_begin))
+      {
+        if (run.type == GateType::XOR_GATE)
+        {
+          shares.xor_wires(run.output, run.lhs, run.rhs, run.length);
+        }
+        else
+        {
+          shares.not_wires(run.output, run.lhs, run.length, true);
+        }
+      }
+      for (int k = layer.and_begin; k < layer.end; k++)
+      {
+        const Gate &g = circuit.gates[k];
+        for (size_t t = 0; t < shares.instances(); t++)
+        {
+          shares.set(g.output, t, shares.get(g.lhs, t) & shares.get(g.rhs, t));
+        }
+      }
+    }
+  }
+
+  void bench_circuits(const std::string &directory)
+  {
+    std::vector<std::string> filenames;
+    for (const auto &entry : std::filesystem::directory_iterator(directory))
+    {
+      std::string name = entry.path().filename().string();
+      if (entry.is_regular_file() && name.find("-input") == std::string::npos)
+      {
+        filenames.push_back(entry.path().string());
+      }
+    }
+    std::sort(filenames.begin(), filenames.end());
+
+    for (const std::string &filename : filenames)
+    {
+      std::string name = std::filesystem::path(filename).stem().string();
+      Circuit circuit;
+      time_repeated("parse_circuit/" + name, 1, [&]
+                    { circuit = parse_circuit(filename); });
+
+      CompiledCircuit compiled(circuit);
+      const size_t num_instances = 64;
+      WireShares shares(compiled.num_wire, num_instances);
+      for (int w = 0; w < compiled.input_length; w++)
+      {
+        for (size_t t = 0; t < num_instances; t++)
+        {
+          shares.set(w, t, PRG::local().generate_bit());
+        }
+      }
+      time_repeated("evaluate_plaintext/" + name + " (gate instances)",
+                    (long long)compiled.num_gate * num_instances, [&]
+                    { evaluate_plaintext(compiled, shares); });
+    }
+  }
+
+  void bench_aead()
+  {
+    CryptoDriver crypto_driver;
+    SecByteBlock shared_key(32);
+    std::memset(shared_key, 0, shared_key.size());
+    auto sender = crypto_driver.AEAD_session_initialize(shared_key, true);
+    auto receiver = crypto_driver.AEAD_session_initialize(shared_key, false);
+
+    for (size_t size : {16, 256, 4096, 65536})
+    {
+      int count = std::clamp<size_t>((64 << 20) / size, 16, 100000);
+      ReceiverToSender_OTExtensionMatrix_Message msg;
+      msg.matrix.assign(size, 'x');
+
+      std::vector<std::vector<unsigned char>> ciphertexts(count);
+      time_once("encrypt_and_tag/" + std::to_string(size), count, [&]
+                {
+        for (int i = 0; i < count; i++)
+        {
+          ciphertexts[i] = crypto_driver.encrypt_and_tag(*sender, 0, &msg);
+        } });
+
+      bool verified = true;
+      time_once("decrypt_and_verify/" + std::to_string(size), count, [&]
+                {
+        for (int i = 0; i < count; i++)
+        {
+          verified &= crypto_driver.decrypt_and_verify(*receiver, 0, std::move(ciphertexts[i])).second;
+        } });
+      if (!verified)
+      {
+        throw std::runtime_error("decrypt_and_verify failed in benchmark");
+      }
+    }
+  }
+
+  void bench_dh()
+  {
+    CryptoDriver crypto_driver;
+    time_repeated("DH_initialize", 1, [&]
+                  { crypto_driver.DH_initialize(); });
+
+    auto [group, private_key, public_key] = crypto_driver.DH_initialize();
+    auto [other_group, other_private_key, other_public_key] = crypto_driver.DH_initialize();
+    time_repeated("DH_generate_shared_key", 1, [&]
+                  { crypto_driver.DH_generate_shared_key(group, private_key, other_public_key); });
+  }
+
+  void bench_ot(int port)
+  {
+    LoopbackPair loopback(port);
+    LoopbackParty &sender = loopback.sender, &receiver = loopback.receiver;
+
+    const int num_single = 100;
+    std::vector<std::string> m = {std::string(16, 'a'), std::string(16, 'b')};
+    time_once("OT_send+OT_recv", num_single, [&]
+              { loopback.both([&]
+                              {
+        for (int j = 0; j < num_single; j++)
+        {
+          sender.ot_driver->OT_send(m);
+        } },
+                              [&]
+                              {
+        for (int j = 0; j < num_single; j++)
+        {
+          receiver.ot_driver->OT_recv(j & 1);
+        } }); });
+
+    const int batch = OT_EXTENSION_WIDTH;
+    std::vector<std::vector<std::string>> ms(batch, m);
+    std::vector<int> choice_bits = PRG::local().generate_bits(batch);
+    time_once("OT_send_batch+OT_recv_batch/" + std::to_string(batch), batch, [&]
+              { loopback.both([&]
+                              { sender.ot_driver->OT_send_batch(ms); },
+                              [&]
+                              { receiver.ot_driver->OT_recv_batch(choice_bits); }); });
+
+    loopback.both([&]
+                  { sender.ot_driver->OT_extension_setup_sender(); },
+                  [&]
+                  { receiver.ot_driver->OT_extension_setup_receiver(); });
+
+    const int num_ots = 1 << 16;
+    std::vector<std::vector<int>> options(num_ots);
+    std::vector<int> choices(num_ots);
+    for (int j = 0; j < num_ots; j++)
+    {
+      std::vector<int> bits = PRG::local().generate_bits(4);
+      options[j] = bits;
+      choices[j] = j & 3;
+    }
+    time_once("ROT4_precompute/" + std::to_string(num_ots), num_ots, [&]
+              { loopback.both([&]
+                              { sender.ot_driver->ROT4_precompute_send(num_ots); },
+                              [&]
+                              { receiver.ot_driver->ROT4_precompute_recv(num_ots); }); });
+    time_once("OT_extension_send+OT_extension_recv/" + std::to_string(num_ots), num_ots, [&]
+              { loopback.both([&]
+                              { sender.ot_driver->OT_extension_send(options); },
+                              [&]
+                              { receiver.ot_driver->OT_extension_recv(choices); }); });
+  }
+
+  void bench_shares()
+  {
+    ShareDriver sd(0, 2);
+    const int n = 1 << 20;
+    time_repeated("generate_random_shares (bits)", n, [&]
+                  { sd.generate_random_shares(n); });
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  std::string json_file;
+  if (argc > 2 && std::string(argv[1]) == "--json")
+  {
+    json_file = argv[2];
+    argc -= 2;
+    argv += 2;
+  }
+  std::string directory = argc > 1 ? argv[1] : "circuits";
+  int port = argc > 2 ? std::stoi(argv[2]) : 7521;
+
+  bench_circuits(directory);
+  bench_aead();
+  bench_dh();
+  bench_ot(port);
+  bench_shares();
+  if (json_file.empty())
+  {
+    print_results(std::cout);
+  }
+  else
+  {
+    std::ofstream out(json_file);
+    print_results(out);
+    if (!out)
+    {
+      std::cerr << "Could not write " << json_file << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "../include-shared/constants.hpp"
+#include "../include-shared/messages.hpp"
+#include "../include/pkg/loopback.hpp"
+
+/*
+ * Usage: ./ot_bench [number of OTs] [port]
+ *
+ * Compares the base OTs in the 2048-bit DL group with those over P-256. Both
+ * parties run in this process, talking over a loopback socket, and each batch
+ * holds the given number of 1-out-of-2 OTs on 16-byte strings (by default
+ * OT_EXTENSION_WIDTH, as many as OT extension setup runs).
+ */
+namespace
+{
+  // Runs one batch and returns the seconds it took and the number of wrong
+  // results.
+  template <typename Send, typename Recv>
+  std::pair<double, int> run(LoopbackPair &loopback, Send send, Recv recv, int num_ots)
+  {
+    CryptoPP::AutoSeededRandomPool rng;
+    std::vector<std::vector<std::string>> m(num_ots);
+    std::vector<int> choice_bits(num_ots);
+    for (int j = 0; j < num_ots; j++)
+    {
+      for (int i = 0; i < 2; i++)
+      {
+        SecByteBlock value(16);
+        rng.GenerateBlock(value, value.size());
+        m[j].push_back(std::string((const char *)value.data(), value.size()));
+      }
+      choice_bits[j] = rng.GenerateBit();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> received = loopback.both([&]
+                                                      { send(m); },
+                                                      [&]
+                                                      { return recv(choice_bits); });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int wrong = 0;
+    for (int j = 0; j < num_ots; j++)
+    {
+      wrong += received[j] != m[j][choice_bits[j]];
+    }
+    return {seconds, wrong};
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int num_ots = argc > 1 ? std::stoi(argv[1]) : OT_EXTENSION_WIDTH;
+  int port = argc > 2 ? std::stoi(argv[2]) : 7519;
+
+  LoopbackPair loopback(port);
+  LoopbackParty &sender = loopback.sender, &receiver = loopback.receiver;
+
+  // Warm up the cached groups and the keypair pools before timing.
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+
+  auto [dl_seconds, dl_wrong] = run(loopback, [&](auto m)
+                                    { sender.ot_driver->DL_OT_send_batch(m); },
+                                    [&](auto c)
+                                    { return receiver.ot_driver->DL_OT_recv_batch(c); },
+                                    num_ots);
+  auto [ec_seconds, ec_wrong] = run(loopback, [&](auto m)
+                                    { sender.ot_driver->OT_send_batch(m); },
+                                    [&](auto c)
+                                    { return receiver.ot_driver->OT_recv_batch(c); },
+                                    num_ots);
+
+  int ec_point_size = sender.crypto_driver->EC_group().GetEncodedElementSize(true);
+  std::cout << num_ots << " base OTs" << std::endl;
+  std::cout << "  DL 2048-bit: " << dl_seconds * 1e3 << " ms, " << DL_P.ByteCount()
+            << "-byte elements, 2 per OT, " << dl_wrong << " wrong" << std::endl;
+  std::cout << "  P-256:       " << ec_seconds * 1e3 << " ms, " << ec_point_size
+            << "-byte points, 1 per OT, " << ec_wrong << " wrong" << std::endl;
+  std::cout << "  speedup:     " << dl_seconds / ec_seconds << "x" << std::endl;
+  return dl_wrong || ec_wrong;
+}
@@ -0,0 +1,77 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "../include-shared/circuit.hpp"
+
+/*
+ * Usage: ./parse_bench [circuit file] [repetitions]
+ *
+ * Measures circuit parsing throughput. With a file, times parse_circuit on it;
+ * without one, times parse_circuit_text on a synthetic Bristol circuit of
+ * 10M gates (one AND per four gates) built in memory.
+ */
+namespace
+{
+  std::string synthetic_circuit(int num_gate)
+  {
+    int num_input = 1 << 16;
+    std::string text = std::to_string(num_gate) + " " + std::to_string(num_input + num_gate) + "\n" +
+                       std::to_string(num_input / 2) + " " + std::to_string(num_input / 2) + " 64\n\n";
+    text.reserve((size_t)num_gate * 32);
+
+    // Gates read mostly recent wires, as real circuits do.
+    uint64_t state = 1;
+    for (int g = 0; g < num_gate; g++)
+    {
+      int wire = num_input + g;
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      int lhs = wire - 1 - (int)((state >> 33) % std::min(wire, 4096));
+      int rhs = wire - 1 - (int)((state >> 45) % std::min(wire, 4096));
+      text += "2 1 " + std::to_string(lhs) + " " + std::to_string(rhs) + " " + std::to_string(wire) +
+              (g % 4 == 0 ? " AND\n" : " XOR\n");
+    }
+    return text;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  std::string filename = argc > 1 ? argv[1] : "";
+  int repetitions = argc > 2 ? std::stoi(argv[2]) : 5;
+
+  std::string text;
+  if (filename.empty())
+  {
+    text = synthetic_circuit(10000000);
+  }
+
+  double best = 0;
+  size_t bytes = text.size();
+  int num_gate = 0;
+  for (int r = 0; r < repetitions; r++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    Circuit circuit = filename.empty() ? parse_circuit_text(text.data(), text.size())
+                                       : parse_circuit(filename);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (r == 0 || seconds < best)
+    {
+      best = seconds;
+    }
+    num_gate = circuit.num_gate;
+  }
+
+  if (!filename.empty())
+  {
+    FILE *f = fopen(filename.c_str(), "rb");
+    fseek(f, 0, SEEK_END);
+    bytes = ftell(f);
+    fclose(f);
+  }
+  std::cout << (filename.empty() ? "synthetic" : filename) << ": " << num_gate << " gates, "
+            << bytes / 1e6 << " MB in " << best << " s (best of " << repetitions << "): "
+            << num_gate / best / 1e6 << " Mgates/s, " << bytes / best / 1e6 << " MB/s" << std::endl;
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <crypto++/osrng.h>
+
+#include "../include-shared/prg.hpp"
+
+/*
+ * Usage: ./prg_bench [number of bits]
+ *
+ * Compares sampling random bits the old way, one AutoSeededRandomPool per
+ * bit, with the thread-local AES-CTR PRG, one bit at a time and in bulk. The
+ * old path reseeds from the OS on every call, so it runs on far fewer bits.
+ */
+namespace
+{
+  template <typename F>
+  double ns_per_bit(F f, size_t num_bits)
+  {
+    auto start = std::chrono::steady_clock::now();
+    f(num_bits);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds * 1e9 / num_bits;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  size_t num_bits = argc > 1 ? std::stoul(argv[1]) : 100000000;
+  size_t num_pool_bits = std::max<size_t>(num_bits / 10000, 1);
+
+  // Keep a result so the loops are not optimized away.
+  int sink = 0;
+  double pool = ns_per_bit([&](size_t n)
+                           {
+    for (size_t i = 0; i < n; i++)
+    {
+      CryptoPP::AutoSeededRandomPool rng;
+      sink ^= rng.GenerateBit();
+    } },
+                           num_pool_bits);
+  double single = ns_per_bit([&](size_t n)
+                             {
+    PRG &prg = PRG::local();
+    for (size_t i = 0; i < n; i++)
+    {
+      sink ^= prg.generate_bit();
+    } },
+                             num_bits);
+  double bulk = ns_per_bit([&](size_t n)
+                           {
+    std::vector<int> bits = PRG::local().generate_bits(n);
+    sink ^= bits[n / 2]; },
+                           num_bits);
+  double words = ns_per_bit([&](size_t n)
+                            {
+    std::vector<uint64_t> words((n + 63) / 64);
+    PRG::local().generate_words(words.data(), words.size());
+    sink ^= words[0] & 1; },
+                            num_bits);
+
+  std::cout << "AutoSeededRandomPool per bit: " << pool << " ns/bit (" << num_pool_bits << " bits)" << std::endl;
+  std::cout << "PRG generate_bit:             " << single << " ns/bit" << std::endl;
+  std::cout << "PRG generate_bits:            " << bulk << " ns/bit" << std::endl;
+  std::cout << "PRG generate_words:           " << words << " ns/bit" << std::endl;
+  std::cout << "speedup per bit:              " << pool / single << "x" << std::endl;
+  return sink > 1;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ================================================
+// BIT VECTOR
+// ================================================
+
+/*
+ * A packed vector of bits stored in 64-bit words. Bit i lives in word i / 64
+ * at position i % 64. Used to store one secret share per wire.
+ */
+class BitVector {
+public:
+  BitVector(size_t num_bits = 0);
+
+  size_t size() const;
+  int get(size_t i) const;
+  void set(size_t i, int bit);
+
+  // Read or write len <= 64 bits starting at an arbitrary bit offset.
+  uint64_t get_bits(size_t offset, size_t len) const;
+  void set_bits(size_t offset, uint64_t bits, size_t len);
+
+  // Word-level gate evaluation over ranges of len bits. The output range must
+  // not overlap either input range.
+  void xor_range(size_t out, size_t lhs, size_t rhs, size_t len);
+  void not_range(size_t out, size_t in, size_t len, bool flip);
+
+private:
+  std::vector<uint64_t> words;
+  size_t num_bits;
+};
+
+/*
+ * Secret shares of every wire for num_instances independent evaluations of
+ * the same circuit. The shares of wire w are bit-sliced into bits
+ * [w * num_instances, (w + 1) * num_instances), so a gate over consecutive
+ * wires becomes one range operation over all of their instances.
+ */
+class WireShares {
+public:
+  WireShares(size_t num_wires, size_t num_instances = 1);
+
+  size_t instances() const;
+  int get(size_t wire, size_t instance = 0) const;
+  void set(size_t wire, size_t instance, int bit);
+
+  // Evaluate num_wires consecutive XOR or NOT gates on every instance.
+  void xor_wires(size_t out, size_t lhs, size_t rhs, size_t num_wires);
+  void not_wires(size_t out, size_t in, size_t num_wires, bool flip);
+
+private:
+  BitVector bits;
+  size_t num_instances;
+};
+
+// Whole-word kernels, dispatched to AVX2 where the CPU supports it.
+void xor_words(uint64_t *out, const uint64_t *lhs, const uint64_t *rhs,
+               size_t num_words);
+void not_words(uint64_t *out, const uint64_t *in, size_t num_words, bool flip);
@@ -26,10 +26,61 @@ struct Gate {
 
 struct Circuit {
   int num_gate, num_wire, input_length,
-      output_length;
+      output_length, num_and_gate;
   std::vector<Gate> gates;
+  // Lengths of the input and output groups, in order. Bristol files have two
+  // input groups and one output group.
+  std::vector<int> input_groups, output_groups;
 };
 Circuit parse_circuit(std::string filename);
+Circuit parse_circuit_text(const char *data, size_t size,
+                           const std::string &name = "<circuit>");
+
+// ================================================
+// LEVELIZED CIRCUIT
+// ================================================
+
+/*
+ * A layer of a levelized circuit. The local (XOR/NOT) gates of a layer live in
+ * gates[local_begin, and_begin) and its AND gates in gates[and_begin, end).
+ * Local gates only depend on earlier layers or earlier local gates of the same
+ * layer, and AND gates only depend on wires that are ready once the layer's
+ * local gates are evaluated, so every AND of a layer fits in one round.
+ */
+struct CircuitLayer {
+  int local_begin, and_begin, end;
+};
+
+struct LevelizedCircuit {
+  std::vector<Gate> gates; // gates reordered layer by layer
+  std::vector<CircuitLayer> layers;
+};
+LevelizedCircuit levelize_circuit(const Circuit &circuit);
+
+/*
+ * Rename the wires of a levelized circuit to share slots, reusing a slot as
+ * soon as the value in it has been read for the last time, so evaluation only
+ * needs as many slots as the circuit is wide. Inputs keep slots
+ * [0, input_length) and the outputs take the last output_length slots, so the
+ * result reads like a circuit with fewer wires. Returns the number of slots.
+ */
+int assign_wire_slots(LevelizedCircuit &levelized, int num_wire,
+                      int input_length, int output_length);
+
+/*
+ * A run of `length` local gates of the same type where the k-th gate reads
+ * lhs + k (and rhs + k) and writes output + k, and no gate reads an output of
+ * the run. A run can be evaluated with word-level operations.
+ */
+struct GateRun {
+  GateType::T type;
+  int lhs, rhs, output, length;
+};
+std::vector<GateRun> find_gate_runs(const Gate *gates, int begin, int end);
+inline std::vector<GateRun> find_gate_runs(const std::vector<Gate> &gates,
+                                           int begin, int end) {
+  return find_gate_runs(gates.data(), begin, end);
+}
 
 // ================================================
 // GARBLED CIRCUIT
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "circuit.hpp"
+
+// ================================================
+// CIRCUIT OPTIMIZER
+// ================================================
+
+/*
+ * Gate counts before and after optimization.
+ */
+struct OptimizerReport {
+  int gates_before, gates_after;
+  int and_gates_before, and_gates_after;
+};
+
+/*
+ * Rewrite a circuit into an equivalent one with as few AND gates as the
+ * passes can find. The passes, in order:
+ *
+ *   1. Constant folding: XOR(w, w) = 0, AND(w, w) = w, AND(w, NOT w) = 0, and
+ *      gates with a constant input reduce to a wire or a constant.
+ *   2. NOT folding: NOT gates become a polarity on the wire that reads them,
+ *      and XOR absorbs the polarity of its inputs.
+ *   3. Common-subexpression elimination: gates with the same type and inputs
+ *      (in either order) are computed once.
+ *   4. Dead-gate elimination: only gates that an output depends on are kept.
+ *
+ * Passes 1-3 run together as one forward value-numbering sweep, so each can
+ * use the others' results on the same gate.
+ *
+ * The result keeps the input wires first and the output wires last, with the
+ * wires in between renumbered densely. Constants and negations are only
+ * materialized where an output needs them, as XOR(w, w) and NOT gates.
+ */
+Circuit optimize_circuit(const Circuit &circuit,
+                         OptimizerReport *report = nullptr);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "circuit.hpp"
+
+// ================================================
+// BRISTOL READER
+// ================================================
+
+/*
+ * Incremental reader for circuits in Bristol or Bristol Fashion format (see
+ * parse_circuit_text). The header is read on construction and gates are read
+ * on demand, so a caller can work through a circuit without holding all of it.
+ * Integers and gate names are scanned straight out of data, which must stay
+ * valid while the reader is in use.
+ */
+class BristolReader {
+public:
+  BristolReader(const char *data, size_t size, const std::string &name);
+
+  // From the header. num_gate counts gate lines, so a MAND is one gate.
+  int num_gate, num_wire, input_length, output_length;
+  std::vector<int> input_groups, output_groups;
+  // AND gates read so far.
+  int num_and_gate = 0;
+
+  // Appends the gates of the next max_lines gate lines to gates. Returns
+  // false once every gate has been read and the end of the file checked.
+  bool read_gates(std::vector<Gate> &gates, size_t max_lines);
+
+  // Bytes of data consumed so far.
+  size_t offset() const;
+
+private:
+  const char *begin;
+  const char *p;
+  const char *end;
+  std::string name;
+  int line = 1;
+  int lines_read = 0;
+  bool finished = false;
+  std::vector<bool> written;
+  std::vector<int> wires;
+
+  [[noreturn]] void fail(const std::string &message) const;
+  void skip_blanks();
+  void skip_space();
+  bool at_end();
+  bool at_line_end();
+  bool next_line_has_name();
+  int next_int(const char *what);
+  std::string_view next_word();
+  std::vector<int> line_ints(const char *what);
+  void read_groups();
+  int read_wire(int wire);
+  int write_wire(int wire);
+  void expect_arity(std::string_view type, int num_in, int num_out,
+                    int want_in, int want_out);
+  void read_gate(std::vector<Gate> &gates);
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "circuit.hpp"
+
+// ================================================
+// COMPILED CIRCUIT
+// ================================================
+
+/*
+ * On-disk layout of a compiled circuit, in host byte order:
+ *
+ *   CompiledCircuitHeader
+ *   uint32_t output_groups[num_output_groups]
+ *   CircuitLayer layers[num_layers]
+ *   Gate gates[num_gate]            (levelized order)
+ *
+ * The checksum is FNV-1a over the header, with the checksum field zeroed, and
+ * then everything after it. Files are meant to be
+ * built on the host that runs them, with compile_circuit.
+ */
+#define COMPILED_CIRCUIT_MAGIC "GMWCIRC"
+#define COMPILED_CIRCUIT_VERSION 3
+
+struct CompiledCircuitHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_wire, input_length, output_length;
+  uint32_t num_gate, num_and_gate, num_layers;
+  uint32_t num_output_groups;
+  uint64_t checksum;
+};
+
+#define COMPILED_CHECKSUM_SEED 0xcbf29ce484222325ULL
+uint64_t compiled_checksum(uint64_t hash, const void *data, size_t size);
+uint64_t compiled_header_checksum(const CompiledCircuitHeader &header);
+void check_compiled_header(const CompiledCircuitHeader &header,
+                           size_t file_size, const std::string &filename);
+std::vector<int> read_output_groups(const CompiledCircuitHeader &header);
+bool is_valid_gate(const Gate &g, int num_wire);
+
+/*
+ * A levelized circuit ready for evaluation. Built either in memory from a
+ * parsed circuit, or by mapping a compiled circuit file and using its gate
+ * arrays in place, so processes on one host share the page-cache copy.
+ *
+ * Wires are share slots (see assign_wire_slots), so num_wire is the number of
+ * shares evaluation keeps, which is usually far below the source circuit's
+ * wire count.
+ */
+class CompiledCircuit {
+public:
+  explicit CompiledCircuit(const Circuit &circuit);
+  explicit CompiledCircuit(const std::string &filename);
+  ~CompiledCircuit();
+
+  CompiledCircuit(const CompiledCircuit &) = delete;
+  CompiledCircuit &operator=(const CompiledCircuit &) = delete;
+
+  static bool is_compiled(const std::string &filename);
+  void write(const std::string &filename) const;
+
+  int num_wire, input_length, output_length, num_gate, num_and_gate;
+  int num_layers;
+  // Lengths of the output groups.
+  std::vector<int> output_groups;
+  const Gate *gates;
+  const CircuitLayer *layers;
+
+private:
+  // Set when the gates live in a file mapping.
+  void *mapping = nullptr;
+  size_t mapping_size = 0;
+  // Set when the gates were levelized in memory.
+  LevelizedCircuit levelized;
+};
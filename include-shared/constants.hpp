@@ -9,6 +9,17 @@
 
 #define EG_KEYSIZE 1024
 
+#define OT_EXTENSION_WIDTH 192 /* 1-of-4 extension code length, in bits */
+#define DH_KEYPAIR_POOL_SIZE 256 /* DH keypairs generated ahead of use */
+#define STREAM_RANDOM_OTS 4096   /* random OTs per peer made before streaming */
+
+#define NETWORK_READ_BUFFER_SIZE 65536 /* per connection, in bytes */
+#define NETWORK_MAX_WRITE_BATCH 512    /* frames per gathered write */
+#define NETWORK_CLOSE_TIMEOUT_MS 5000  /* wait for queued writes at shutdown */
+
+#define GATE_STREAM_CHUNK_SIZE 65536 /* gates per streamed chunk */
+#define GATE_STREAM_READ_AHEAD 4     /* chunks read ahead of evaluation */
+
 // Primes from https://www.rfc-editor.org/rfc/rfc5114#page-4
 const CryptoPP::Integer DL_P =
     CryptoPP::Integer("0x87A8E61DB4B6663CFFBBD19C651959998CEEF608660DD0F2"
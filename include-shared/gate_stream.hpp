@@ -0,0 +1,78 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "circuit.hpp"
+#include "circuit_parser.hpp"
+#include "constants.hpp"
+
+// ================================================
+// GATE STREAM
+// ================================================
+
+/*
+ * Reads the gates of a circuit file, Bristol text or compiled, in chunks on a
+ * background thread, keeping at most read_ahead chunks queued. The file is
+ * mapped and the pages behind the reader are dropped as it goes, so memory
+ * stays bounded by the read-ahead however long the circuit is.
+ *
+ * Gates come out in file order, which is a topological order. Compiled files
+ * are checked gate by gate, and their checksum and AND count once the last
+ * chunk is read.
+ */
+class GateStream {
+public:
+  explicit GateStream(const std::string &filename,
+                      size_t chunk_size = GATE_STREAM_CHUNK_SIZE,
+                      size_t read_ahead = GATE_STREAM_READ_AHEAD);
+  ~GateStream();
+
+  GateStream(const GateStream &) = delete;
+  GateStream &operator=(const GateStream &) = delete;
+
+  int num_wire, input_length, output_length;
+  // Lengths of the output groups.
+  std::vector<int> output_groups;
+  // AND gates in the circuit, or -1 for Bristol text, whose header does not
+  // say.
+  long long num_and_gate;
+
+  // Moves the next chunk of gates into chunk. Returns false once the circuit
+  // is exhausted. Errors found by the reader are rethrown here, after the
+  // chunks before them.
+  bool next(std::vector<Gate> &chunk);
+
+private:
+  std::string filename;
+  void *mapping = nullptr;
+  size_t mapping_size = 0;
+  size_t chunk_size, read_ahead;
+
+  // Bristol text.
+  std::unique_ptr<BristolReader> reader;
+  // Compiled circuits.
+  const Gate *compiled_gates = nullptr;
+  size_t compiled_num_gate = 0, compiled_next_gate = 0;
+  long long compiled_and_gates = 0;
+  uint64_t checksum = 0, expected_checksum = 0;
+
+  std::thread reader_thread;
+  std::mutex mutex;
+  std::condition_variable chunk_ready, space_ready;
+  std::deque<std::vector<Gate>> chunks;
+  bool finished = false, stopping = false;
+  std::exception_ptr error;
+  size_t released = 0;
+
+  bool read_chunk(std::vector<Gate> &chunk);
+  void read_chunks();
+  void release_before(size_t offset);
+};
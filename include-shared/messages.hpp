@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -13,6 +14,7 @@
 #include <crypto++/hex.h>
 #include <crypto++/integer.h>
 #include <crypto++/nbtheory.h>
+#include <crypto++/secblock.h>
 
 #include "../include-shared/circuit.hpp"
 
@@ -24,17 +26,22 @@ namespace MessageType
 {
   enum T
   {
-    HMACTagged_Wrapper = 1,
     DHPublicValue_Message = 2,
-    SenderToReceiver_OTPublicValue_Message = 3,
-    ReceiverToSender_OTPublicValue_Message = 4,
-    SenderToReceiver_OTEncryptedValues_Message = 5,
+    SenderToReceiver_OTPublicValueBatch_Message = 6,
+    ReceiverToSender_OTPublicValueBatch_Message = 7,
+    SenderToReceiver_OTEncryptedValuesBatch_Message = 8,
+    SenderToReceiver_ECOTPublicValue_Message = 15,
+    ReceiverToSender_ECOTPublicValueBatch_Message = 16,
+    SenderToReceiver_ECOTEncryptedValuesBatch_Message = 17,
 
-    InitialShare_Message = 10,
-    FinalGossip_Message = 11,
+    ReceiverToSender_OTExtensionMatrix_Message = 12,
+    SenderToReceiver_OTExtensionMaskedBits_Message = 13,
+    ReceiverToSender_OTChoiceOffsets_Message = 18,
+
+    OutputShares_Message = 11,
+    MaskedShares_Message = 14,
   };
 };
-MessageType::T get_message_type(std::vector<unsigned char> &data);
 
 // ================================================
 // SERIALIZABLE
@@ -46,89 +53,290 @@ struct Serializable
   virtual int deserialize(std::vector<unsigned char> &data) = 0;
 };
 
+/*
+ * Binary wire format. Sizes and lengths are LEB128 varints, group elements are
+ * fixed-width big-endian, and bit vectors are packed eight to a byte. The
+ * deserializers throw if data ends before the value does.
+ */
+
 // serializers.
-int put_bool(bool b, std::vector<unsigned char> &data);
-int put_string(std::string s, std::vector<unsigned char> &data);
-int put_integer(CryptoPP::Integer i, std::vector<unsigned char> &data);
+int put_string(const std::string &s, std::vector<unsigned char> &data);
+int put_size(size_t n, std::vector<unsigned char> &data);
+int put_element(const CryptoPP::SecByteBlock &element,
+                std::vector<unsigned char> &data);
+int put_bits(const std::vector<int> &bits, std::vector<unsigned char> &data);
 
 // deserializers
-int get_bool(bool *b, std::vector<unsigned char> &data, int idx);
 int get_string(std::string *s, std::vector<unsigned char> &data, int idx);
-int get_integer(CryptoPP::Integer *i, std::vector<unsigned char> &data,
-                int idx);
+int get_size(size_t *n, std::vector<unsigned char> &data, int idx);
+int get_element(CryptoPP::SecByteBlock *element,
+                std::vector<unsigned char> &data, int idx);
+int get_bits(std::vector<int> *bits, std::vector<unsigned char> &data,
+             int idx);
 
-// ================================================
-// WRAPPERS
-// ================================================
+/*
+ * Field visitors. A message lists its fields once, in a fields(f) template,
+ * and the same list drives both serialization (with a MessageWriter) and
+ * deserialization (with a MessageReader).
+ */
+class MessageWriter
+{
+public:
+  MessageWriter(std::vector<unsigned char> &data) : data(data) {}
+
+  void size(size_t n) { put_size(n, data); }
+  void bytes(const std::string &s) { put_string(s, data); }
+  void bytes(const std::vector<unsigned char> &v);
+  void bytes(const CryptoPP::SecByteBlock &b);
+  void element(const CryptoPP::SecByteBlock &b) { put_element(b, data); }
+  void bits(const std::vector<int> &b) { put_bits(b, data); }
+
+  template <class T, class F>
+  void list(const std::vector<T> &values, F each)
+  {
+    size(values.size());
+    for (auto &value : values)
+    {
+      each(value);
+    }
+  }
+
+private:
+  std::vector<unsigned char> &data;
+};
 
-struct HMACTagged_Wrapper : public Serializable
+class MessageReader
 {
-  std::vector<unsigned char> payload;
-  CryptoPP::SecByteBlock iv;
-  std::string mac;
+public:
+  MessageReader(std::vector<unsigned char> &data, int idx)
+      : data(data), idx(idx) {}
+
+  void size(size_t &n) { idx += get_size(&n, data, idx); }
+  void bytes(std::string &s) { idx += get_string(&s, data, idx); }
+  void bytes(std::vector<unsigned char> &v);
+  void bytes(CryptoPP::SecByteBlock &b);
+  void element(CryptoPP::SecByteBlock &b) { idx += get_element(&b, data, idx); }
+  void bits(std::vector<int> &b) { idx += get_bits(&b, data, idx); }
+
+  template <class T, class F>
+  void list(std::vector<T> &values, F each)
+  {
+    size_t n;
+    size(n);
+    // Every encoded value takes at least one byte.
+    if (n > data.size() - idx)
+    {
+      throw std::runtime_error("Message list is longer than the message");
+    }
+    values.clear();
+    values.resize(n);
+    for (auto &value : values)
+    {
+      each(value);
+    }
+  }
+
+  int position() const { return idx; }
 
-  void serialize(std::vector<unsigned char> &data);
-  int deserialize(std::vector<unsigned char> &data);
+private:
+  std::vector<unsigned char> &data;
+  int idx;
+};
+
+/*
+ * Base for messages: writes the type byte and the fields on serialize, and
+ * checks the type byte and reads the fields back on deserialize.
+ */
+template <class Derived, MessageType::T Type>
+struct Message : public Serializable
+{
+  void serialize(std::vector<unsigned char> &data)
+  {
+    data.push_back((char)Type);
+    MessageWriter writer(data);
+    static_cast<Derived *>(this)->fields(writer);
+  }
+
+  int deserialize(std::vector<unsigned char> &data)
+  {
+    if (data.empty() || data[0] != Type)
+    {
+      throw std::runtime_error("Received unexpected message type");
+    }
+    MessageReader reader(data, 1);
+    static_cast<Derived *>(this)->fields(reader);
+    return reader.position();
+  }
 };
 
 // ================================================
 // KEY EXCHANGE
 // ================================================
 
-struct DHPublicValue_Message : public Serializable
+struct DHPublicValue_Message
+    : public Message<DHPublicValue_Message, MessageType::DHPublicValue_Message>
 {
   CryptoPP::SecByteBlock public_value;
 
-  void serialize(std::vector<unsigned char> &data);
-  int deserialize(std::vector<unsigned char> &data);
+  template <class F>
+  void fields(F &f) { f.element(public_value); }
 };
 
 // ================================================
 // OBLIVIOUS TRANSFER
 // ================================================
 
-struct SenderToReceiver_OTPublicValue_Message : public Serializable
+// OTs in the DL group, batched: one message carries the values of every OT
+// in a batch, so a whole batch costs three messages instead of three per OT.
+struct SenderToReceiver_OTPublicValueBatch_Message
+    : public Message<SenderToReceiver_OTPublicValueBatch_Message,
+                     MessageType::SenderToReceiver_OTPublicValueBatch_Message>
 {
-  CryptoPP::SecByteBlock public_value;
+  std::vector<CryptoPP::SecByteBlock> public_values;
 
-  void serialize(std::vector<unsigned char> &data);
-  int deserialize(std::vector<unsigned char> &data);
+  template <class F>
+  void fields(F &f)
+  {
+    f.list(public_values, [&](auto &v)
+           { f.element(v); });
+  }
+};
+
+struct ReceiverToSender_OTPublicValueBatch_Message
+    : public Message<ReceiverToSender_OTPublicValueBatch_Message,
+                     MessageType::ReceiverToSender_OTPublicValueBatch_Message>
+{
+  std::vector<CryptoPP::SecByteBlock> public_values;
+
+  template <class F>
+  void fields(F &f)
+  {
+    f.list(public_values, [&](auto &v)
+           { f.element(v); });
+  }
 };
 
-struct ReceiverToSender_OTPublicValue_Message : public Serializable
+struct SenderToReceiver_OTEncryptedValuesBatch_Message
+    : public Message<SenderToReceiver_OTEncryptedValuesBatch_Message,
+                     MessageType::SenderToReceiver_OTEncryptedValuesBatch_Message>
+{
+  // encryptions[j] and ivs[j] hold the options of the j-th OT in the batch
+  std::vector<std::vector<std::string>> encryptions;
+  std::vector<std::vector<CryptoPP::SecByteBlock>> ivs;
+
+  template <class F>
+  void fields(F &f)
+  {
+    f.list(encryptions, [&](auto &options)
+           { f.list(options, [&](auto &s)
+                    { f.bytes(s); }); });
+    f.list(ivs, [&](auto &options)
+           { f.list(options, [&](auto &iv)
+                    { f.bytes(iv); }); });
+  }
+};
+
+// Elliptic-curve base OT. The sender's one public point serves the whole
+// batch. Points are compressed, and each option is encrypted under its own
+// key, so no IVs are needed.
+struct SenderToReceiver_ECOTPublicValue_Message
+    : public Message<SenderToReceiver_ECOTPublicValue_Message,
+                     MessageType::SenderToReceiver_ECOTPublicValue_Message>
 {
   CryptoPP::SecByteBlock public_value;
 
-  void serialize(std::vector<unsigned char> &data);
-  int deserialize(std::vector<unsigned char> &data);
+  template <class F>
+  void fields(F &f) { f.bytes(public_value); }
+};
+
+struct ReceiverToSender_ECOTPublicValueBatch_Message
+    : public Message<ReceiverToSender_ECOTPublicValueBatch_Message,
+                     MessageType::ReceiverToSender_ECOTPublicValueBatch_Message>
+{
+  std::vector<CryptoPP::SecByteBlock> public_values;
+
+  template <class F>
+  void fields(F &f)
+  {
+    f.list(public_values, [&](auto &v)
+           { f.bytes(v); });
+  }
+};
+
+struct SenderToReceiver_ECOTEncryptedValuesBatch_Message
+    : public Message<SenderToReceiver_ECOTEncryptedValuesBatch_Message,
+                     MessageType::SenderToReceiver_ECOTEncryptedValuesBatch_Message>
+{
+  // encryptions[j] holds the options of the j-th OT in the batch
+  std::vector<std::vector<std::string>> encryptions;
+
+  template <class F>
+  void fields(F &f)
+  {
+    f.list(encryptions, [&](auto &options)
+           { f.list(options, [&](auto &s)
+                    { f.bytes(s); }); });
+  }
+};
+
+// ================================================
+// OT EXTENSION
+// ================================================
+
+struct ReceiverToSender_OTExtensionMatrix_Message
+    : public Message<ReceiverToSender_OTExtensionMatrix_Message,
+                     MessageType::ReceiverToSender_OTExtensionMatrix_Message>
+{
+  // OT_EXTENSION_WIDTH columns, one bit per extended OT each
+  std::string matrix;
+
+  template <class F>
+  void fields(F &f) { f.bytes(matrix); }
+};
+
+struct ReceiverToSender_OTChoiceOffsets_Message
+    : public Message<ReceiverToSender_OTChoiceOffsets_Message,
+                     MessageType::ReceiverToSender_OTChoiceOffsets_Message>
+{
+  // c XOR d for every 1-out-of-4 OT, where c is the real choice and d the
+  // precomputed random one, packed two bits per OT
+  std::string offsets;
+
+  template <class F>
+  void fields(F &f) { f.bytes(offsets); }
 };
 
-struct SenderToReceiver_OTEncryptedValues_Message : public Serializable
+struct SenderToReceiver_OTExtensionMaskedBits_Message
+    : public Message<SenderToReceiver_OTExtensionMaskedBits_Message,
+                     MessageType::SenderToReceiver_OTExtensionMaskedBits_Message>
 {
-  std::vector<std::string> encryptions;
-  // we need to send IVs outputted by AES_encrypt
-  std::vector<CryptoPP::SecByteBlock> ivs;
+  // the masked options of every OT, packed as bits
+  std::string masked_bits;
 
-  void serialize(std::vector<unsigned char> &data);
-  int deserialize(std::vector<unsigned char> &data);
+  template <class F>
+  void fields(F &f) { f.bytes(masked_bits); }
 };
 
 // ================================================
 // GMW
 // ================================================
 
-struct InitialShare_Message : public Serializable
+// Our shares of the output wires the receiver reconstructs.
+struct OutputShares_Message
+    : public Message<OutputShares_Message, MessageType::OutputShares_Message>
 {
-  int share_value;
+  std::vector<int> bits;
 
-  void serialize(std::vector<unsigned char> &data);
-  int deserialize(std::vector<unsigned char> &data);
+  template <class F>
+  void fields(F &f) { f.bits(bits); }
 };
 
-struct FinalGossip_Message : public Serializable
+// Our shares of d = x ^ a and e = y ^ b for the AND gates of a layer.
+struct MaskedShares_Message
+    : public Message<MaskedShares_Message, MessageType::MaskedShares_Message>
 {
-  std::string bit_string;
+  std::vector<int> bits;
 
-  void serialize(std::vector<unsigned char> &data);
-  int deserialize(std::vector<unsigned char> &data);
+  template <class F>
+  void fields(F &f) { f.bits(bits); }
 };
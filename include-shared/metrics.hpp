@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// ================================================
+// METRICS
+// ================================================
+
+/*
+ * Cumulative counters of one link to a peer. The network driver fills in the
+ * traffic and the time spent waiting in socket_read, the AEAD session the
+ * time spent on its own and the OT driver's crypto, and the OT driver the
+ * OTs run. The three OT counts are disjoint: a derandomized OT consumes a
+ * random OT, which is counted when it is precomputed, top-ups included.
+ * Subtracting two snapshots gives the counts of what happened between.
+ */
+struct LinkMetrics {
+  uint64_t bytes_sent = 0, bytes_received = 0;
+  uint64_t messages_sent = 0, messages_received = 0;
+  uint64_t wait_ns = 0, crypto_ns = 0;
+  uint64_t base_ots = 0, random_ots = 0, derandomized_ots = 0;
+
+  LinkMetrics operator-(const LinkMetrics &other) const;
+  LinkMetrics &operator+=(const LinkMetrics &other);
+};
+
+/*
+ * Wall time and per-peer LinkMetrics of each phase of a run, in order. A
+ * phase runs from start to stop; the caller passes the cumulative counters of
+ * every link at both ends. Peers with no counters at the start, such as links
+ * made during the phase, count from zero.
+ */
+class PhaseMetrics {
+public:
+  void start(const std::string &name, const std::map<int, LinkMetrics> &links);
+  void stop(const std::map<int, LinkMetrics> &links);
+  void write_json(const std::string &filename, int my_party) const;
+
+private:
+  struct Phase {
+    std::string name;
+    double seconds;
+    std::map<int, LinkMetrics> peers;
+  };
+  std::vector<Phase> phases;
+
+  std::string current_name;
+  std::chrono::steady_clock::time_point current_start;
+  std::map<int, LinkMetrics> current_links;
+};
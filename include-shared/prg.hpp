@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <crypto++/aes.h>
+#include <crypto++/modes.h>
+#include <crypto++/rng.h>
+#include <crypto++/secblock.h>
+
+// ================================================
+// PRG
+// ================================================
+
+#define PRG_BUFFER_SIZE 4096 /* keystream bytes generated at a time */
+
+/*
+ * A pseudorandom generator that expands a 128-bit key with AES in counter
+ * mode, which Crypto++ runs with AES-NI where the CPU has it. Output is drawn
+ * from a buffered keystream, so bits and words cost a few nanoseconds instead
+ * of the OS reads AutoSeededRandomPool makes when it is constructed.
+ *
+ * A PRG is not thread-safe; use local() for one per thread, seeded from the OS
+ * the first time the thread asks for it. As a RandomNumberGenerator it can be
+ * passed to Crypto++ wherever a pool was. Two PRGs built from the same seed
+ * produce the same stream however it is requested, which is what input
+ * sharing and the OT extension columns expand their shared seeds with.
+ */
+class PRG : public CryptoPP::RandomNumberGenerator {
+public:
+  PRG();
+  explicit PRG(const CryptoPP::SecByteBlock &seed);
+
+  PRG(const PRG &) = delete;
+  PRG &operator=(const PRG &) = delete;
+
+  static PRG &local();
+
+  void GenerateBlock(CryptoPP::byte *output, size_t size) override;
+  unsigned int GenerateBit() override;
+
+  int generate_bit();
+  uint64_t generate_word();
+  std::vector<int> generate_bits(size_t n);
+  void generate_words(uint64_t *words, size_t n);
+
+private:
+  void refill();
+
+  CryptoPP::CTR_Mode<CryptoPP::AES>::Encryption cipher;
+  CryptoPP::SecByteBlock buffer;
+  size_t used;
+  uint64_t bit_word = 0;
+  int bits_left = 0;
+};
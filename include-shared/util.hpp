@@ -16,8 +16,8 @@
 #include <crypto++/rng.h>
 
 // String <=> Vec<char>.
-std::string chvec2str(std::vector<unsigned char> data);
-std::vector<unsigned char> str2chvec(std::string s);
+std::string chvec2str(const std::vector<unsigned char> &data);
+std::vector<unsigned char> str2chvec(const std::string &s);
 
 // String <=> Hex.
 std::string hex_encode(std::string s);
@@ -39,6 +39,10 @@ void print_key_as_hex(const CryptoPP::SecByteBlock &block);
 // Randomness.
 int generate_bit();
 
+// Bit packing. Bit i lives in byte i / 8 at position i % 8.
+std::string pack_bits(const std::vector<int> &bits);
+std::vector<int> unpack_bits(const std::string &packed, size_t num_bits);
+
 // Splitter.
 std::vector<std::string> string_split(std::string str, char delimiter);
 
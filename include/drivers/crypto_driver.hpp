@@ -1,42 +1,107 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdlib>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 
 #include <crypto++/cryptlib.h>
 #include <crypto++/dh.h>
 #include <crypto++/dh2.h>
 #include <crypto++/dsa.h>
+#include <crypto++/eccrypto.h>
+#include <crypto++/ecp.h>
 #include <crypto++/elgamal.h>
 #include <crypto++/files.h>
 #include <crypto++/filters.h>
+#include <crypto++/gcm.h>
 #include <crypto++/hex.h>
 #include <crypto++/hkdf.h>
-#include <crypto++/hmac.h>
 #include <crypto++/integer.h>
 #include <crypto++/modes.h>
 #include <crypto++/nbtheory.h>
+#include <crypto++/oids.h>
 #include <crypto++/osrng.h>
 #include <crypto++/rijndael.h>
 #include <crypto++/sha.h>
 
 #include "../../include-shared/messages.hpp"
+#include "../../include-shared/prg.hpp"
 
 using namespace CryptoPP;
 
+#define AEAD_TAG_SIZE 16
+#define AEAD_NONCE_SIZE 12
+
+/**
+ * State of an authenticated session with one peer. Each direction has its own
+ * AES-GCM key. Nonces are implicit: a nonce is the channel id followed by a
+ * per-channel message counter. Channels are delivered in order, so both sides
+ * agree on the counters without sending them.
+ */
+struct AEADSession {
+  GCM<AES>::Encryption encryptor;
+  GCM<AES>::Decryption decryptor;
+  std::map<int, uint64_t> send_counters;
+  std::map<int, uint64_t> recv_counters;
+  std::mutex send_mutex;
+  std::mutex recv_mutex;
+  // Time spent in encrypt_and_tag, decrypt_and_verify and the OT driver's
+  // crypto, for metrics.
+  std::atomic<uint64_t> crypto_ns{0};
+};
+
+/**
+ * Adds the time it runs, from construction or resume until pause or
+ * destruction, to a session's crypto time. Callers pause it around network
+ * calls and around encrypt_and_tag and decrypt_and_verify, which time
+ * themselves.
+ */
+class CryptoTimer {
+public:
+  explicit CryptoTimer(AEADSession &session);
+  ~CryptoTimer();
+
+  CryptoTimer(const CryptoTimer &) = delete;
+  CryptoTimer &operator=(const CryptoTimer &) = delete;
+
+  void pause();
+  void resume();
+
+private:
+  AEADSession &session;
+  std::chrono::steady_clock::time_point start;
+  bool running;
+};
+
 class CryptoDriver {
 public:
-  std::vector<unsigned char> encrypt_and_tag(SecByteBlock AES_key,
-                                             SecByteBlock HMAC_key,
+  CryptoDriver();
+  ~CryptoDriver();
+
+  CryptoDriver(const CryptoDriver &) = delete;
+  CryptoDriver &operator=(const CryptoDriver &) = delete;
+
+  std::shared_ptr<AEADSession>
+  AEAD_session_initialize(const SecByteBlock &DH_shared_key, bool send_first);
+  std::vector<unsigned char> encrypt_and_tag(AEADSession &session, int channel,
                                              Serializable *message);
   std::pair<std::vector<unsigned char>, bool>
-  decrypt_and_verify(SecByteBlock AES_key, SecByteBlock HMAC_key,
+  decrypt_and_verify(AEADSession &session, int channel,
                      std::vector<unsigned char> ciphertext_data);
 
-  std::tuple<DH, SecByteBlock, SecByteBlock> DH_initialize();
+  std::shared_ptr<PRG> PRSS_initialize(const SecByteBlock &DH_shared_key);
+
+  std::tuple<const DH &, SecByteBlock, SecByteBlock> DH_initialize();
+  const DL_GroupParameters_EC<ECP> &EC_group();
   SecByteBlock
   DH_generate_shared_key(const DH &DH_obj, const SecByteBlock &DH_private_value,
                          const SecByteBlock &DH_other_public_value);
@@ -47,9 +112,17 @@ public:
   std::string AES_decrypt(SecByteBlock key, SecByteBlock iv,
                           std::string ciphertext);
 
-  SecByteBlock HMAC_generate_key(const SecByteBlock &DH_shared_key);
-  std::string HMAC_generate(SecByteBlock key, std::string ciphertext);
-  bool HMAC_verify(SecByteBlock key, std::string ciphertext, std::string hmac);
-
   CryptoPP::SecByteBlock hash_inputs(CryptoPP::SecByteBlock &lhs, CryptoPP::SecByteBlock &rhs);
+
+private:
+  // Fresh (private, public) keypairs, kept topped up by a background thread
+  // so that key exchanges and base OTs rarely wait on an exponentiation.
+  std::deque<std::pair<SecByteBlock, SecByteBlock>> keypair_pool;
+  std::mutex keypair_mutex;
+  std::condition_variable keypair_taken;
+  bool stopping = false;
+  std::thread keypair_thread;
+
+  std::pair<SecByteBlock, SecByteBlock> DH_generate_keypair();
+  void fill_keypair_pool();
 };
@@ -1,37 +1,111 @@
 #pragma once
 #include <boost/asio.hpp>
 #include <boost/system/error_code.hpp>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_set>
 
 #include "../../include-shared/messages.hpp"
+#include "../../include-shared/metrics.hpp"
 
+/*
+ * Every frame on a socket is tagged with a logical channel, so independent
+ * sub-protocols can share a socket without reading each other's messages.
+ * PeerLink uses the MessageType of the payload as its channel.
+ */
 class NetworkDriver
 {
 public:
-  virtual std::vector<unsigned char> socket_read(std::shared_ptr<boost::asio::ip::tcp::socket> sock) = 0;
-  virtual void socket_send(std::shared_ptr<boost::asio::ip::tcp::socket> sock, std::vector<unsigned char> data) = 0;
+  virtual std::vector<unsigned char> socket_read(std::shared_ptr<boost::asio::ip::tcp::socket> sock, int channel = 0) = 0;
+  virtual void socket_send(std::shared_ptr<boost::asio::ip::tcp::socket> sock, std::vector<unsigned char> data, int channel = 0) = 0;
+  virtual LinkMetrics socket_metrics(std::shared_ptr<boost::asio::ip::tcp::socket> sock) = 0;
+  virtual void socket_close(std::shared_ptr<boost::asio::ip::tcp::socket> sock) = 0;
 
   virtual std::shared_ptr<boost::asio::ip::tcp::socket> listen(int port) = 0;
   virtual std::shared_ptr<boost::asio::ip::tcp::socket> connect(int other_party, std::string address, int port) = 0;
   virtual void disconnect(int other_party) = 0;
 };
 
+/*
+ * A queued outgoing frame. The header sits next to the payload so both go out
+ * in the same gathered write.
+ */
+struct OutgoingFrame
+{
+  uint32_t header[2];
+  std::vector<unsigned char> payload;
+};
+
+/*
+ * State of one connected socket. Incoming frames are queued per channel by the
+ * IO thread; outgoing frames are queued and written in batches.
+ */
+struct NetworkConnection
+{
+  std::shared_ptr<boost::asio::ip::tcp::socket> socket;
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::map<int, std::deque<std::vector<unsigned char>>> inbox;
+  std::deque<OutgoingFrame> outbox;
+  bool writing = false;
+  // Set once reading fails (e.g. the other side hung up) or writing fails.
+  std::string read_error;
+  std::string write_error;
+  // Frames queued and taken by socket_send and socket_read, with headers, and
+  // the time socket_read spent waiting. Only the network fields are used.
+  LinkMetrics metrics;
+
+  // Receive buffer, reused for the whole connection. Bytes in
+  // [read_begin, read_end) have been received but not yet parsed.
+  std::vector<unsigned char> read_buffer;
+  size_t read_begin = 0;
+  size_t read_end = 0;
+  // Frame too large for the receive buffer, read straight into its payload.
+  int large_channel;
+  std::vector<unsigned char> large_payload;
+};
+
 class NetworkDriverImpl : public NetworkDriver
 {
 public:
   NetworkDriverImpl();
   ~NetworkDriverImpl();
 
-  std::vector<unsigned char> socket_read(std::shared_ptr<boost::asio::ip::tcp::socket> sock);
-  void socket_send(std::shared_ptr<boost::asio::ip::tcp::socket> sock, std::vector<unsigned char> data);
+  std::vector<unsigned char> socket_read(std::shared_ptr<boost::asio::ip::tcp::socket> sock, int channel = 0);
+  void socket_send(std::shared_ptr<boost::asio::ip::tcp::socket> sock, std::vector<unsigned char> data, int channel = 0);
+  LinkMetrics socket_metrics(std::shared_ptr<boost::asio::ip::tcp::socket> sock);
+  void socket_close(std::shared_ptr<boost::asio::ip::tcp::socket> sock);
 
   std::shared_ptr<boost::asio::ip::tcp::socket> listen(int port);
   std::shared_ptr<boost::asio::ip::tcp::socket> connect(int other_party, std::string address, int port);
   void disconnect(int other_party);
+  // Opens the listening socket ahead of listen, so a party in the same
+  // process can connect without racing it. Port 0 takes any free port.
+  // Returns the port bound.
+  int bind(int port);
 
 private:
   // Sharing io_context's allow for performance benefit when doing async IO
   boost::asio::io_context io_context;
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard;
+  std::thread io_thread;
+  std::unique_ptr<boost::asio::ip::tcp::acceptor> acceptor;
+
+  std::mutex connections_mutex;
+  std::map<boost::asio::ip::tcp::socket *, std::shared_ptr<NetworkConnection>> connections;
+
+  void add_connection(std::shared_ptr<boost::asio::ip::tcp::socket> sock);
+  std::shared_ptr<NetworkConnection> get_connection(std::shared_ptr<boost::asio::ip::tcp::socket> sock);
+  void read_frames(std::shared_ptr<NetworkConnection> conn);
+  void read_large_frame(std::shared_ptr<NetworkConnection> conn, size_t offset);
+  bool parse_frames(std::shared_ptr<NetworkConnection> conn);
+  void fail_read(std::shared_ptr<NetworkConnection> conn, const boost::system::error_code &error);
+  void write_frames(std::shared_ptr<NetworkConnection> conn);
 };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <chrono>
 #include <cmath>
 #include <cstdlib>
@@ -24,6 +25,7 @@
 #include <crypto++/sha.h>
 
 #include "../../include-shared/messages.hpp"
+#include "../../include-shared/prg.hpp"
 #include "../../include/drivers/cli_driver.hpp"
 #include "../../include/drivers/crypto_driver.hpp"
 #include "../../include/drivers/network_driver.hpp"
@@ -31,21 +33,70 @@
 class OTDriver
 {
 public:
-  OTDriver(int other_party,
+  OTDriver(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
            std::shared_ptr<NetworkDriver> network_driver,
            std::shared_ptr<CryptoDriver> crypto_driver,
-           std::pair<CryptoPP::SecByteBlock, CryptoPP::SecByteBlock> keys);
+           std::shared_ptr<AEADSession> session);
 
+  // Public-key (base) OT over P-256
   void OT_send(std::vector<std::string> m);
   std::string OT_recv(int choice_bit);
+  void OT_send_batch(std::vector<std::vector<std::string>> m);
+  std::vector<std::string> OT_recv_batch(std::vector<int> choice_bits);
+
+  // The same in the 2048-bit DL group, kept for comparison
+  void DL_OT_send_batch(std::vector<std::vector<std::string>> m);
+  std::vector<std::string> DL_OT_recv_batch(std::vector<int> choice_bits);
+
+  // OT extension setup. Runs OT_EXTENSION_WIDTH base OTs with the roles
+  // reversed, so the extension sender acts as the base OT receiver.
+  void OT_extension_setup_sender();
+  void OT_extension_setup_receiver();
+
+  // Random 1-out-of-4 OTs from the extension: the sender learns four random
+  // keys per OT and the receiver learns the key of its choice.
+  std::vector<std::array<CryptoPP::SecByteBlock, 4>>
+  ROT4_extension_send(int num_ots);
+  std::vector<CryptoPP::SecByteBlock>
+  ROT4_extension_recv(std::vector<int> choices);
+
+  // Random 1-out-of-4 OTs on bits, made ahead of time from the random OTs
+  // above. The sender keeps four random bits per OT, and the receiver a random
+  // choice d and the bit at d. Both sides must precompute the same counts.
+  void ROT4_precompute_send(int num_ots);
+  void ROT4_precompute_recv(int num_ots);
+
+  // Batched 1-out-of-4 OTs on bits. Each consumes one precomputed random OT,
+  // and the pool is topped up first if it is short.
+  void OT_extension_send(std::vector<std::vector<int>> m);
+  std::vector<int> OT_extension_recv(std::vector<int> choice_bits);
+
+  // OTs run so far, each counted once: base OTs, random OTs precomputed
+  // (including top-ups), and OTs on bits derandomized from them.
+  uint64_t base_ots = 0, random_ots = 0, derandomized_ots = 0;
 
 private:
-  int other_party;
+  std::shared_ptr<boost::asio::ip::tcp::socket> socket;
 
   std::shared_ptr<CryptoDriver> crypto_driver;
   std::shared_ptr<NetworkDriver> network_driver;
-  std::shared_ptr<CLIDriver> cli_driver;
 
-  CryptoPP::SecByteBlock AES_key;
-  CryptoPP::SecByteBlock HMAC_key;
+  std::shared_ptr<AEADSession> session;
+
+  // Extension state. The sender keeps its secret s and one PRG per column
+  // seeded with k_i^{s_i}; the receiver keeps PRGs for both k_i^0 and k_i^1.
+  CryptoPP::SecByteBlock extension_secret;
+  std::vector<std::unique_ptr<PRG>> column_prgs_0;
+  std::vector<std::unique_ptr<PRG>> column_prgs_1;
+  // Index of the next extended OT, used to tweak the hash of every OT.
+  uint64_t ot_counter;
+
+  // Precomputed random 1-out-of-4 OTs, one per byte, from rot4_next on. The
+  // sender's bytes hold r_0..r_3 in bits 0-3; the receiver's hold d in bits
+  // 0-1 and r_d in bit 2.
+  std::vector<unsigned char> rot4_pool;
+  size_t rot4_next = 0;
+  void take_rot4_pool_prefix();
+
+  CryptoPP::SecByteBlock hash_row(uint64_t index, const unsigned char *row);
 };
@@ -1,18 +1,36 @@
 #pragma once
 
 #include <cstdlib>
+#include <utility>
 #include <vector>
 #include <string>
 #include <sys/ioctl.h>
 
+// Our shares of a boolean multiplication triple, where c = a & b once the shares of all
+// parties are XORed together.
+struct BeaverTriple
+{
+  int a;
+  int b;
+  int c;
+};
+
 class ShareDriver
 {
 public:
   ShareDriver(int my_party, int num_parties);
 
-  // generate_shares creates num_parties secret shares such that they all XOR to be target.
-  // The secret share for my_party must be equal to the XOR of target and all the other shares.
-  std::vector<int> generate_shares(int target);
+  // generate_random_shares samples n uniformly random shares, such as our shares of the
+  // a and b values of Beaver triples.
+  std::vector<int> generate_random_shares(int n);
+
+  // beaver_mask returns our shares of d = x ^ a and e = y ^ b, given our shares of the
+  // inputs of an AND gate and of a triple.
+  std::pair<int, int> beaver_mask(int x, int y, const BeaverTriple &triple);
+
+  // beaver_combine returns our share of x & y once d and e have been opened. Only party 0
+  // adds the public d & e term.
+  int beaver_combine(int d, int e, const BeaverTriple &triple);
 
 private:
   // The party-index of this party, from [0, num_parties)
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <exception>
+#include <future>
+#include <memory>
+#include <type_traits>
+
+#include "../../include/drivers/crypto_driver.hpp"
+#include "../../include/drivers/network_driver.hpp"
+#include "../../include/drivers/ot_driver.hpp"
+
+/*
+ * One side of a LoopbackPair, with drivers of its own as a separate process
+ * would have.
+ */
+struct LoopbackParty
+{
+  std::shared_ptr<NetworkDriverImpl> network_driver;
+  std::shared_ptr<CryptoDriver> crypto_driver;
+  std::shared_ptr<boost::asio::ip::tcp::socket> socket;
+  std::shared_ptr<OTDriver> ot_driver;
+};
+
+/*
+ * Two parties in one process connected over a loopback socket, for benchmarks
+ * and tests. The sender binds the port before the receiver connects, so the
+ * connect never races the accept; port 0 takes any free port. Both sessions
+ * come from one random key that is never sent, since only the protocols on
+ * top are being measured or checked.
+ */
+class LoopbackPair
+{
+public:
+  explicit LoopbackPair(int port = 0);
+
+  LoopbackPair(const LoopbackPair &) = delete;
+  LoopbackPair &operator=(const LoopbackPair &) = delete;
+
+  // Runs send as the sender on another thread and recv as the receiver on
+  // this one, and returns what recv returns. If either side throws, both
+  // sockets are closed so the other side cannot wait forever, and the first
+  // error is rethrown.
+  template <typename Send, typename Recv>
+  std::invoke_result_t<Recv> both(Send send, Recv recv);
+
+  // Closes both sockets, failing any read or send in progress.
+  void close();
+
+  LoopbackParty sender, receiver;
+  int port;
+};
+
+template <typename Send, typename Recv>
+std::invoke_result_t<Recv> LoopbackPair::both(Send send, Recv recv)
+{
+  auto sent = std::async(std::launch::async, [&]
+                         {
+    try
+    {
+      send();
+    }
+    catch (...)
+    {
+      close();
+      throw;
+    } });
+  try
+  {
+    if constexpr (std::is_void_v<std::invoke_result_t<Recv>>)
+    {
+      recv();
+      sent.get();
+    }
+    else
+    {
+      auto result = recv();
+      sent.get();
+      return result;
+    }
+  }
+  catch (...)
+  {
+    close();
+    sent.wait();
+    throw;
+  }
+}
@@ -1,38 +1,91 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
 #include "../../include-shared/circuit.hpp"
 #include "../../include/drivers/cli_driver.hpp"
 #include "../../include/drivers/crypto_driver.hpp"
 #include "../../include/drivers/network_driver.hpp"
 #include "../../include/drivers/ot_driver.hpp"
 
+/*
+ * A thread that runs the tasks posted to it in order, for as long as it lives.
+ */
+class PeerWorker
+{
+public:
+  PeerWorker();
+  ~PeerWorker();
+
+  PeerWorker(const PeerWorker &) = delete;
+  PeerWorker &operator=(const PeerWorker &) = delete;
+
+  void post(std::function<void()> task);
+
+private:
+  void run();
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::function<void()>> tasks;
+  bool stopping = false;
+  std::thread thread;
+};
+
 class PeerLink
 {
 public:
   PeerLink(std::shared_ptr<boost::asio::ip::tcp::socket> sock, std::shared_ptr<NetworkDriver> network_driver, std::shared_ptr<CryptoDriver> crypto_driver);
 
+  // Metrics
+  LinkMetrics GetMetrics();
+
+  // Runs task on this link's worker thread, which lives as long as the link,
+  // so per-thread state such as PRG::local() is set up once per peer.
+  void Post(std::function<void()> task);
+  // Closes the link. Reads blocked on it, on either side, fail.
+  void Close();
+
   // Key exchange
   void SendFirstHandleKeyExchange();
   void ReadFirstHandleKeyExchange();
 
   // Initial secret sharing
-  void SendSecretShare(int share);
-  int ReceiveSecretShare();
+  std::vector<int> InputSharingBits(int n);
 
   // OT
   void OT_send(std::vector<int> choices);
   int OT_recv(int choice_bit);
+  void OT_send_batch(std::vector<std::vector<int>> choices);
+  std::vector<int> OT_recv_batch(std::vector<int> choice_bits);
+  void SetupOTExtension(bool ot_sender);
+  void PrecomputeOTs(int num_ots);
+
+  // Beaver triple openings
+  void SendMaskedShares(std::vector<int> bits);
+  std::vector<int> ReceiveMaskedShares();
 
-  // Final gossip
-  void GossipSend(std::string bit_string);
-  std::string GossipReceive();
+  // Output reconstruction
+  void SendOutputShares(std::vector<int> bits);
+  std::vector<int> ReceiveOutputShares();
 
-  CryptoPP::SecByteBlock AES_key;
-  CryptoPP::SecByteBlock HMAC_key;
+  // AES-GCM session established by key exchange, shared with the OT driver
+  std::shared_ptr<AEADSession> session;
 
 private:
   std::shared_ptr<boost::asio::ip::tcp::socket> socket;
 
   std::shared_ptr<NetworkDriver> network_driver;
   std::shared_ptr<CryptoDriver> crypto_driver;
+  std::shared_ptr<OTDriver> ot_driver;
+  bool ot_sender;
+  // Shared by copies of the link
+  std::shared_ptr<PeerWorker> worker;
+
+  // PRG shared with the other party, seeded by key exchange
+  std::shared_ptr<PRG> input_prg;
 };
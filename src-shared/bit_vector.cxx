@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "bit_vector.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BIT_VECTOR_HAVE_AVX2_KERNELS
+#endif
+
+namespace {
+uint64_t low_mask(size_t len) {
+  return len >= 64 ? ~uint64_t(0) : ((uint64_t(1) << len) - 1);
+}
+
+#ifdef BIT_VECTOR_HAVE_AVX2_KERNELS
+__attribute__((target("avx2"))) void
+xor_words_avx2(uint64_t *out, const uint64_t *lhs, const uint64_t *rhs,
+               size_t num_words) {
+  size_t i = 0;
+  for (; i + 4 <= num_words; i += 4) {
+    __m256i l = _mm256_loadu_si256((const __m256i *)(lhs + i));
+    __m256i r = _mm256_loadu_si256((const __m256i *)(rhs + i));
+    _mm256_storeu_si256((__m256i *)(out + i), _mm256_xor_si256(l, r));
+  }
+  for (; i < num_words; ++i)
+    out[i] = lhs[i] ^ rhs[i];
+}
+
+__attribute__((target("avx2"))) void
+not_words_avx2(uint64_t *out, const uint64_t *in, size_t num_words) {
+  const __m256i ones = _mm256_set1_epi64x(-1);
+  size_t i = 0;
+  for (; i + 4 <= num_words; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+    _mm256_storeu_si256((__m256i *)(out + i), _mm256_xor_si256(v, ones));
+  }
+  for (; i < num_words; ++i)
+    out[i] = ~in[i];
+}
+
+bool cpu_has_avx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+#endif
+} // namespace
+
+/*
+ * XOR num_words words of lhs and rhs into out.
+ */
+void xor_words(uint64_t *out, const uint64_t *lhs, const uint64_t *rhs,
+               size_t num_words) {
+#ifdef BIT_VECTOR_HAVE_AVX2_KERNELS
+  if (cpu_has_avx2()) {
+    xor_words_avx2(out, lhs, rhs, num_words);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < num_words; ++i)
+    out[i] = lhs[i] ^ rhs[i];
+}
+
+/*
+ * Copy num_words words of in into out, complementing them if flip is set.
+ */
+void not_words(uint64_t *out, const uint64_t *in, size_t num_words,
+               bool flip) {
+  if (!flip) {
+    std::memmove(out, in, num_words * sizeof(uint64_t));
+    return;
+  }
+#ifdef BIT_VECTOR_HAVE_AVX2_KERNELS
+  if (cpu_has_avx2()) {
+    not_words_avx2(out, in, num_words);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < num_words; ++i)
+    out[i] = ~in[i];
+}
+
+/*
+ * Constructor. All bits start as zero.
+ */
+BitVector::BitVector(size_t num_bits)
+    : words((num_bits + 63) / 64, 0), num_bits(num_bits) {}
+
+size_t BitVector::size() const { return num_bits; }
+
+int BitVector::get(size_t i) const { return (words[i / 64] >> (i % 64)) & 1; }
+
+void BitVector::set(size_t i, int bit) {
+  uint64_t mask = uint64_t(1) << (i % 64);
+  words[i / 64] = (words[i / 64] & ~mask) | ((uint64_t)(bit & 1) << (i % 64));
+}
+
+/*
+ * Get len <= 64 bits starting at bit offset, which may straddle two words.
+ */
+uint64_t BitVector::get_bits(size_t offset, size_t len) const {
+  size_t idx = offset / 64, shift = offset % 64;
+  uint64_t bits = words[idx] >> shift;
+  if (shift != 0 && shift + len > 64)
+    bits |= words[idx + 1] << (64 - shift);
+  return bits & low_mask(len);
+}
+
+/*
+ * Set len <= 64 bits starting at bit offset, leaving the other bits intact.
+ */
+void BitVector::set_bits(size_t offset, uint64_t bits, size_t len) {
+  size_t idx = offset / 64, shift = offset % 64;
+  uint64_t mask = low_mask(len);
+  bits &= mask;
+  words[idx] = (words[idx] & ~(mask << shift)) | (bits << shift);
+  if (shift != 0 && shift + len > 64) {
+    size_t high = 64 - shift;
+    words[idx + 1] =
+        (words[idx + 1] & ~(mask >> high)) | (bits >> high);
+  }
+}
+
+/*
+ * out[k] = lhs[k] ^ rhs[k] for k in [0, len). When all three ranges start on a
+ * word boundary the bulk runs as whole-word kernels, otherwise 64 bits at a
+ * time through get_bits/set_bits.
+ */
+void BitVector::xor_range(size_t out, size_t lhs, size_t rhs, size_t len) {
+  if (out + len > num_bits || lhs + len > num_bits || rhs + len > num_bits)
+    throw std::out_of_range("BitVector::xor_range out of range");
+
+  size_t k = 0;
+  if (out % 64 == 0 && lhs % 64 == 0 && rhs % 64 == 0) {
+    size_t num_words = len / 64;
+    xor_words(&words[out / 64], &words[lhs / 64], &words[rhs / 64], num_words);
+    k = num_words * 64;
+  }
+  for (; k < len; k += 64) {
+    size_t n = std::min<size_t>(64, len - k);
+    set_bits(out + k, get_bits(lhs + k, n) ^ get_bits(rhs + k, n), n);
+  }
+}
+
+/*
+ * out[k] = in[k] ^ flip for k in [0, len).
+ */
+void BitVector::not_range(size_t out, size_t in, size_t len, bool flip) {
+  if (out + len > num_bits || in + len > num_bits)
+    throw std::out_of_range("BitVector::not_range out of range");
+
+  size_t k = 0;
+  if (out % 64 == 0 && in % 64 == 0) {
+    size_t num_words = len / 64;
+    not_words(&words[out / 64], &words[in / 64], num_words, flip);
+    k = num_words * 64;
+  }
+  for (; k < len; k += 64) {
+    size_t n = std::min<size_t>(64, len - k);
+    uint64_t bits = get_bits(in + k, n);
+    set_bits(out + k, flip ? ~bits : bits, n);
+  }
+}
+
+/*
+ * Constructor. All shares start as zero.
+ */
+WireShares::WireShares(size_t num_wires, size_t num_instances)
+    : bits(num_wires * num_instances), num_instances(num_instances) {}
+
+size_t WireShares::instances() const { return num_instances; }
+
+int WireShares::get(size_t wire, size_t instance) const {
+  return bits.get(wire * num_instances + instance);
+}
+
+void WireShares::set(size_t wire, size_t instance, int bit) {
+  bits.set(wire * num_instances + instance, bit);
+}
+
+void WireShares::xor_wires(size_t out, size_t lhs, size_t rhs,
+                           size_t num_wires) {
+  bits.xor_range(out * num_instances, lhs * num_instances,
+                 rhs * num_instances, num_wires * num_instances);
+}
+
+void WireShares::not_wires(size_t out, size_t in, size_t num_wires,
+                           bool flip) {
+  bits.not_range(out * num_instances, in * num_instances,
+                 num_wires * num_instances, flip);
+}
@@ -1,45 +1,210 @@
+#include <algorithm>
+#include <climits>
 #include <iostream>
+#include <stdexcept>
 
 #include "circuit.hpp"
 #include "crypto++/sha.h"
 
 /*
- * Parse circuit from file in Bristol format.
+ * Group the gates of a circuit by multiplicative depth. Inputs have depth 0, a
+ * XOR/NOT gate has the depth of its deepest input, and an AND gate has one more
+ * than that. Layer d holds the local gates of depth d and the AND gates whose
+ * inputs have depth d, in file order (which is a topological order in Bristol).
  */
-Circuit parse_circuit(std::string filename) {
-  Circuit circuit;
-
-  int garbler_input_length;
-  int evaluator_input_length;
-
-  // Open file, scan header.
-  FILE *f = fopen(filename.c_str(), "r");
-  (void)fscanf(f, "%d%d\n", &circuit.num_gate, &circuit.num_wire);
-  (void)fscanf(f, "%d%d%d\n", &garbler_input_length,
-               &evaluator_input_length, &circuit.output_length);
-  (void)fscanf(f, "\n");
-
-  // Compute the input_length from the garbler and evaluator length, so that we don't have to
-  // change the existing input files.
-  circuit.input_length = garbler_input_length + evaluator_input_length;
-
-  // Scan gates.
-  circuit.gates.resize(circuit.num_gate);
-  int tmp, lhs, rhs, output;
-  char str[10];
-  for (int i = 0; i < circuit.num_gate; ++i) {
-    (void)fscanf(f, "%d", &tmp);
-    if (tmp == 2) {
-      (void)fscanf(f, "%d%d%d%d%s", &tmp, &lhs, &rhs, &output, str);
-      if (str[0] == 'A')
-        circuit.gates[i] = {GateType::AND_GATE, lhs, rhs, output};
-      else if (str[0] == 'X')
-        circuit.gates[i] = {GateType::XOR_GATE, lhs, rhs, output};
-    } else if (tmp == 1) {
-      (void)fscanf(f, "%d%d%d%s", &tmp, &lhs, &output, str);
-      circuit.gates[i] = {GateType::NOT_GATE, lhs, 0, output};
-    }
-  }
-
-  return circuit;
+LevelizedCircuit levelize_circuit(const Circuit &circuit) {
+  std::vector<int> depth(circuit.num_wire, 0);
+  std::vector<std::vector<Gate>> local_gates;
+  std::vector<std::vector<Gate>> and_gates;
+
+  for (const Gate &g : circuit.gates) {
+    int d = depth[g.lhs];
+    if (g.type != GateType::NOT_GATE) {
+      d = std::max(d, depth[g.rhs]);
+    }
+
+    if (local_gates.size() <= (size_t)d) {
+      local_gates.resize(d + 1);
+      and_gates.resize(d + 1);
+    }
+
+    if (g.type == GateType::AND_GATE) {
+      and_gates[d].push_back(g);
+      depth[g.output] = d + 1;
+    } else {
+      local_gates[d].push_back(g);
+      depth[g.output] = d;
+    }
+  }
+
+  LevelizedCircuit levelized;
+  levelized.gates.reserve(circuit.gates.size());
+  for (size_t d = 0; d < local_gates.size(); ++d) {
+    CircuitLayer layer;
+    layer.local_begin = levelized.gates.size();
+    levelized.gates.insert(levelized.gates.end(), local_gates[d].begin(),
+                           local_gates[d].end());
+    layer.and_begin = levelized.gates.size();
+    levelized.gates.insert(levelized.gates.end(), and_gates[d].begin(),
+                           and_gates[d].end());
+    layer.end = levelized.gates.size();
+    levelized.layers.push_back(layer);
+  }
+
+  return levelized;
+}
+
+/*
+ * Slots are handed out in evaluation order, and a gate may write a slot that
+ * its own inputs just gave up. That is safe because a gate reads its inputs
+ * before writing, the ANDs of a layer are all read before any is written, and
+ * find_gate_runs never groups gates whose inputs and outputs overlap.
+ */
+int assign_wire_slots(LevelizedCircuit &levelized, int num_wire,
+                      int input_length, int output_length) {
+  std::vector<Gate> &gates = levelized.gates;
+
+  // An output that is an input never written needs a value of its own in an
+  // output slot. Two in-place NOTs at the start give it one.
+  std::vector<char> written(num_wire, 0);
+  for (const Gate &g : gates) {
+    written[g.output] = 1;
+  }
+  std::vector<Gate> copies;
+  for (int w = num_wire - output_length; w < num_wire; ++w) {
+    if (written[w]) {
+      continue;
+    }
+    if (w >= input_length) {
+      throw std::runtime_error("assign_wire_slots: output wire " +
+                               std::to_string(w) + " is never set");
+    }
+    copies.push_back({GateType::NOT_GATE, w, 0, w});
+    copies.push_back({GateType::NOT_GATE, w, 0, w});
+  }
+  if (!copies.empty()) {
+    if (levelized.layers.empty()) {
+      levelized.layers.push_back({0, 0, 0});
+    }
+    gates.insert(gates.begin(), copies.begin(), copies.end());
+    for (size_t d = 0; d < levelized.layers.size(); ++d) {
+      CircuitLayer &layer = levelized.layers[d];
+      layer.local_begin += d == 0 ? 0 : copies.size();
+      layer.and_begin += copies.size();
+      layer.end += copies.size();
+    }
+  }
+
+  // Pass 1: give every write a value of its own and find the last gate that
+  // reads each value. Values below input_length are the inputs; gate k
+  // writes value input_length + k. Gates are rewritten to values in place.
+  const int NEVER = -1;
+  const int FOREVER = INT_MAX;
+  std::vector<int> value_of(num_wire, -1);
+  for (int i = 0; i < input_length; ++i) {
+    value_of[i] = i;
+  }
+  std::vector<int> last_use(input_length + gates.size(), NEVER);
+  for (size_t k = 0; k < gates.size(); ++k) {
+    Gate &g = gates[k];
+    auto read = [&](int wire) {
+      int value = value_of[wire];
+      if (value < 0) {
+        throw std::runtime_error("assign_wire_slots: wire " +
+                                 std::to_string(wire) + " is read before it is set");
+      }
+      last_use[value] = k;
+      return value;
+    };
+    g.lhs = read(g.lhs);
+    g.rhs = g.type == GateType::NOT_GATE ? g.lhs : read(g.rhs);
+    value_of[g.output] = input_length + k;
+    g.output = input_length + k;
+  }
+
+  // Output k is pinned to slot first_output + k, which is only known at the
+  // end, so it is marked as -2 - k until then.
+  std::vector<int> slot_of(last_use.size(), -1);
+  for (int k = 0; k < output_length; ++k) {
+    int value = value_of[num_wire - output_length + k];
+    last_use[value] = FOREVER;
+    slot_of[value] = -2 - k;
+  }
+
+  // Pass 2: hand out slots, recycling the most recently freed one first.
+  std::vector<int> free_slots;
+  for (int i = input_length - 1; i >= 0; --i) {
+    slot_of[i] = i;
+    if (last_use[i] == NEVER) {
+      free_slots.push_back(i);
+    }
+  }
+  int next_slot = input_length;
+  for (size_t k = 0; k < gates.size(); ++k) {
+    Gate &g = gates[k];
+    int lhs = g.lhs, rhs = g.rhs, output = g.output;
+    g.lhs = slot_of[lhs];
+    g.rhs = g.type == GateType::NOT_GATE ? 0 : slot_of[rhs];
+    if (last_use[lhs] == (int)k) {
+      free_slots.push_back(slot_of[lhs]);
+    }
+    if (rhs != lhs && last_use[rhs] == (int)k) {
+      free_slots.push_back(slot_of[rhs]);
+    }
+
+    if (slot_of[output] == -1) {
+      if (free_slots.empty()) {
+        slot_of[output] = next_slot++;
+      } else {
+        slot_of[output] = free_slots.back();
+        free_slots.pop_back();
+      }
+      if (last_use[output] == NEVER) {
+        free_slots.push_back(slot_of[output]);
+      }
+    }
+    g.output = slot_of[output];
+  }
+
+  int first_output = next_slot;
+  auto place_output = [&](int &slot) {
+    if (slot <= -2) {
+      slot = first_output + (-2 - slot);
+    }
+  };
+  for (Gate &g : gates) {
+    place_output(g.lhs);
+    place_output(g.rhs);
+    place_output(g.output);
+  }
+  return first_output + output_length;
+}
+
+/*
+ * Split the local gates in gates[begin, end) into maximal runs of consecutive
+ * gates whose wire indices all advance by one. Gates that do not line up form
+ * runs of length 1.
+ */
+std::vector<GateRun> find_gate_runs(const Gate *gates, int begin, int end) {
+  std::vector<GateRun> runs;
+  for (int k = begin; k < end; ++k) {
+    const Gate &g = gates[k];
+    if (!runs.empty()) {
+      GateRun &run = runs.back();
+      int length = run.length + 1;
+      auto overlaps_output = [&](int in) {
+        return in < run.output + length && run.output < in + length;
+      };
+      bool independent = !overlaps_output(run.lhs) &&
+                         (g.type == GateType::NOT_GATE || !overlaps_output(run.rhs));
+      if (g.type == run.type && g.lhs == run.lhs + run.length &&
+          (g.type == GateType::NOT_GATE || g.rhs == run.rhs + run.length) &&
+          g.output == run.output + run.length && independent) {
+        run.length++;
+        continue;
+      }
+    }
+    runs.push_back({g.type, g.lhs, g.rhs, g.output, 1});
+  }
+  return runs;
 }
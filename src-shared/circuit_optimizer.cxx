@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "circuit_optimizer.hpp"
+
+namespace {
+/*
+ * A value in the optimizer: node `node` XOR `neg`, or the constant `neg` when
+ * node is CONSTANT. Nodes 0..input_length-1 are the inputs; every later node
+ * is an AND, XOR or NOT of earlier nodes.
+ */
+const int CONSTANT = -1;
+
+struct Ref {
+  int node;
+  bool neg;
+};
+
+struct Node {
+  GateType::T type;
+  int lhs, rhs; // rhs is unused for NOT
+};
+
+class ValueNumbering {
+public:
+  explicit ValueNumbering(int input_length) : num_inputs(input_length) {}
+
+  std::vector<Node> nodes; // nodes[k] is node num_inputs + k
+
+  Ref constant(bool value) { return {CONSTANT, value}; }
+  Ref input(int i) { return {i, false}; }
+
+  Ref make_not(Ref a) { return {a.node, !a.neg}; }
+
+  Ref make_xor(Ref a, Ref b) {
+    a = strip_not(a);
+    b = strip_not(b);
+    if (a.node == CONSTANT) {
+      return {b.node, b.neg != a.neg};
+    }
+    if (b.node == CONSTANT) {
+      return {a.node, a.neg != b.neg};
+    }
+    if (a.node == b.node) {
+      return constant(a.neg != b.neg);
+    }
+    return {make_node(GateType::XOR_GATE, a.node, b.node), a.neg != b.neg};
+  }
+
+  /*
+   * An AND needs its inputs with their polarity applied, so negated inputs
+   * read a (shared) NOT node. But if an AND of the same nodes with other
+   * polarities already exists, reuse it with local XORs instead, since
+   * (u ^ s) & (v ^ t) = uv ^ sv ^ tu ^ st.
+   */
+  Ref make_and(Ref a, Ref b) {
+    a = strip_not(a);
+    b = strip_not(b);
+    if (a.node == CONSTANT) {
+      return a.neg ? b : constant(false);
+    }
+    if (b.node == CONSTANT) {
+      return b.neg ? a : constant(false);
+    }
+    if (a.node == b.node) {
+      return a.neg == b.neg ? a : constant(false);
+    }
+
+    for (int variant = 0; variant < 4; ++variant) {
+      Ref u = {a.node, a.neg != (bool)(variant & 1)};
+      Ref v = {b.node, b.neg != (bool)(variant & 2)};
+      int u_node = find_polarity(u);
+      int v_node = find_polarity(v);
+      if (u_node == -1 || v_node == -1) {
+        continue;
+      }
+      int existing = find_node(GateType::AND_GATE, u_node, v_node);
+      if (existing == -1) {
+        continue;
+      }
+      Ref result = {existing, false};
+      if (variant & 1) {
+        result = make_xor(result, v);
+      }
+      if (variant & 2) {
+        result = make_xor(result, u);
+      }
+      result.neg = result.neg != (variant == 3);
+      return result;
+    }
+
+    return {make_node(GateType::AND_GATE, apply_polarity(a), apply_polarity(b)),
+            false};
+  }
+
+private:
+  int num_inputs;
+  std::unordered_map<uint64_t, int> seen;
+
+  static uint64_t key(GateType::T type, int lhs, int rhs) {
+    if (lhs > rhs) {
+      std::swap(lhs, rhs);
+    }
+    return ((uint64_t)lhs << 32 | (uint32_t)rhs) << 2 | type;
+  }
+
+  int find_node(GateType::T type, int lhs, int rhs) {
+    auto it = seen.find(key(type, lhs, rhs));
+    return it == seen.end() ? -1 : it->second;
+  }
+
+  int make_node(GateType::T type, int lhs, int rhs) {
+    int node = find_node(type, lhs, rhs);
+    if (node != -1) {
+      return node;
+    }
+    node = num_inputs + nodes.size();
+    nodes.push_back({type, lhs, rhs});
+    seen[key(type, lhs, rhs)] = node;
+    return node;
+  }
+
+  // NOT nodes only ever feed ANDs; everywhere else the plain node is used.
+  Ref strip_not(Ref a) {
+    if (a.node >= num_inputs &&
+        nodes[a.node - num_inputs].type == GateType::NOT_GATE) {
+      return {nodes[a.node - num_inputs].lhs, !a.neg};
+    }
+    return a;
+  }
+
+  int find_polarity(Ref a) {
+    return a.neg ? find_node(GateType::NOT_GATE, a.node, a.node) : a.node;
+  }
+
+  int apply_polarity(Ref a) {
+    return a.neg ? make_node(GateType::NOT_GATE, a.node, a.node) : a.node;
+  }
+};
+
+/*
+ * Passes 1-3: walk the gates in order and give every wire a value.
+ */
+std::vector<Ref> number_values(const Circuit &circuit, ValueNumbering &values) {
+  std::vector<Ref> wires(circuit.num_wire, values.constant(false));
+  for (int i = 0; i < circuit.input_length; ++i) {
+    wires[i] = values.input(i);
+  }
+
+  for (const Gate &g : circuit.gates) {
+    switch (g.type) {
+    case GateType::NOT_GATE:
+      wires[g.output] = values.make_not(wires[g.lhs]);
+      break;
+    case GateType::XOR_GATE:
+      wires[g.output] = values.make_xor(wires[g.lhs], wires[g.rhs]);
+      break;
+    case GateType::AND_GATE:
+      wires[g.output] = values.make_and(wires[g.lhs], wires[g.rhs]);
+      break;
+    }
+  }
+
+  std::vector<Ref> outputs;
+  for (int i = circuit.num_wire - circuit.output_length; i < circuit.num_wire;
+       ++i) {
+    outputs.push_back(wires[i]);
+  }
+  return outputs;
+}
+
+/*
+ * Pass 4: mark the nodes that some output depends on.
+ */
+std::vector<bool> find_live_nodes(const ValueNumbering &values,
+                                  int input_length,
+                                  const std::vector<Ref> &outputs) {
+  std::vector<bool> live(input_length + values.nodes.size(), false);
+  for (const Ref &r : outputs) {
+    if (r.node != CONSTANT) {
+      live[r.node] = true;
+    }
+  }
+  for (int n = live.size() - 1; n >= input_length; --n) {
+    if (live[n]) {
+      const Node &node = values.nodes[n - input_length];
+      live[node.lhs] = true;
+      live[node.rhs] = true;
+    }
+  }
+  return live;
+}
+
+/*
+ * Turn the live nodes back into gates. A node that is exactly an output
+ * writes the output wire directly; other outputs get a copy gate.
+ */
+Circuit lower_circuit(const Circuit &circuit, const ValueNumbering &values,
+                      const std::vector<Ref> &outputs,
+                      const std::vector<bool> &live) {
+  int input_length = circuit.input_length;
+  int output_length = circuit.output_length;
+
+  // Let each output claim the node it equals, if no other output did first.
+  std::vector<int> claimed_by(live.size(), -1);
+  std::vector<bool> needs_copy(output_length, true);
+  bool needs_zero = false;
+  for (int k = 0; k < output_length; ++k) {
+    const Ref &r = outputs[k];
+    if (r.node >= input_length && !r.neg && claimed_by[r.node] == -1) {
+      claimed_by[r.node] = k;
+      needs_copy[k] = false;
+    } else if ((r.node == CONSTANT && r.neg) ||
+               (r.node != CONSTANT && !r.neg)) {
+      // Copies of a wire and the constant 1 both need a zero wire.
+      needs_zero = true;
+    }
+  }
+  // The zero wire and constant outputs are built from input wire 0.
+  bool has_constant = std::any_of(outputs.begin(), outputs.end(),
+                                  [](const Ref &r) { return r.node == CONSTANT; });
+  if ((needs_zero || has_constant) && input_length == 0) {
+    throw std::runtime_error(
+        "optimize_circuit: constant outputs need at least one input wire");
+  }
+
+  // Number the wires: inputs, then unclaimed live nodes, then the zero wire,
+  // then the outputs.
+  std::vector<int> wire_of(live.size(), -1);
+  for (int i = 0; i < input_length; ++i) {
+    wire_of[i] = i;
+  }
+  int next_wire = input_length;
+  for (size_t n = input_length; n < live.size(); ++n) {
+    if (live[n] && claimed_by[n] == -1) {
+      wire_of[n] = next_wire++;
+    }
+  }
+  int zero_wire = needs_zero ? next_wire++ : -1;
+  int first_output = next_wire;
+  for (size_t n = input_length; n < live.size(); ++n) {
+    if (claimed_by[n] != -1) {
+      wire_of[n] = first_output + claimed_by[n];
+    }
+  }
+
+  Circuit result;
+  result.input_length = input_length;
+  result.output_length = output_length;
+  result.num_wire = first_output + output_length;
+  result.num_and_gate = 0;
+  result.input_groups = circuit.input_groups;
+  result.output_groups = circuit.output_groups;
+
+  if (needs_zero) {
+    result.gates.push_back({GateType::XOR_GATE, 0, 0, zero_wire});
+  }
+  for (size_t n = input_length; n < live.size(); ++n) {
+    if (live[n]) {
+      const Node &node = values.nodes[n - input_length];
+      int rhs = node.type == GateType::NOT_GATE ? 0 : wire_of[node.rhs];
+      result.gates.push_back({node.type, wire_of[node.lhs], rhs, wire_of[n]});
+      if (node.type == GateType::AND_GATE) {
+        result.num_and_gate++;
+      }
+    }
+  }
+  for (int k = 0; k < output_length; ++k) {
+    if (!needs_copy[k]) {
+      continue;
+    }
+    const Ref &r = outputs[k];
+    int output = first_output + k;
+    if (r.node == CONSTANT) {
+      if (r.neg) {
+        result.gates.push_back({GateType::NOT_GATE, zero_wire, 0, output});
+      } else {
+        result.gates.push_back({GateType::XOR_GATE, 0, 0, output});
+      }
+    } else if (r.neg) {
+      result.gates.push_back({GateType::NOT_GATE, wire_of[r.node], 0, output});
+    } else {
+      result.gates.push_back(
+          {GateType::XOR_GATE, wire_of[r.node], zero_wire, output});
+    }
+  }
+  result.num_gate = result.gates.size();
+  return result;
+}
+} // namespace
+
+/*
+ * Run the optimizer passes over a circuit. See circuit_optimizer.hpp. If the
+ * passes save no AND gates and the rewrite is not smaller overall, the
+ * original circuit is kept.
+ */
+Circuit optimize_circuit(const Circuit &circuit, OptimizerReport *report) {
+  ValueNumbering values(circuit.input_length);
+  std::vector<Ref> outputs = number_values(circuit, values);
+  std::vector<bool> live =
+      find_live_nodes(values, circuit.input_length, outputs);
+  Circuit result = lower_circuit(circuit, values, outputs, live);
+
+  int and_gates_before =
+      std::count_if(circuit.gates.begin(), circuit.gates.end(),
+                    [](const Gate &g) { return g.type == GateType::AND_GATE; });
+  if (result.num_and_gate == and_gates_before &&
+      result.gates.size() >= circuit.gates.size()) {
+    result = circuit;
+    result.num_and_gate = and_gates_before;
+  }
+
+  if (report) {
+    report->gates_before = circuit.gates.size();
+    report->gates_after = result.gates.size();
+    report->and_gates_before = and_gates_before;
+    report->and_gates_after = result.num_and_gate;
+  }
+  return result;
+}
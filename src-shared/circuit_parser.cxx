@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "circuit_parser.hpp"
+
+namespace {
+bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+int sum(const std::vector<int> &values) {
+  long long total = 0;
+  for (int v : values) {
+    total += v;
+  }
+  return total > INT_MAX ? INT_MAX : total;
+}
+} // namespace
+
+/*
+ * Read the header. Nothing is copied; the reader only tracks its position and
+ * the line number for error messages.
+ */
+BristolReader::BristolReader(const char *data, size_t size,
+                             const std::string &name)
+    : begin(data), p(data), end(data + size), name(name) {
+  num_gate = next_int("gate count");
+  num_wire = next_int("wire count");
+  if (!at_line_end()) {
+    fail("expected only the gate and wire counts");
+  }
+  read_groups();
+  input_length = sum(input_groups);
+  output_length = sum(output_groups);
+  if (input_length > num_wire || output_length > num_wire) {
+    fail("inputs or outputs do not fit in " + std::to_string(num_wire) +
+         " wires");
+  }
+
+  written.assign(num_wire, false);
+  std::fill(written.begin(), written.begin() + input_length, true);
+}
+
+size_t BristolReader::offset() const { return p - begin; }
+
+void BristolReader::fail(const std::string &message) const {
+  throw std::runtime_error(name + ":" + std::to_string(line) + ": " + message);
+}
+
+// Skips spaces, but stops at a newline.
+void BristolReader::skip_blanks() {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+    ++p;
+  }
+}
+
+// Skips spaces and newlines.
+void BristolReader::skip_space() {
+  while (p < end) {
+    if (*p == '\n') {
+      ++line;
+    } else if (*p != ' ' && *p != '\t' && *p != '\r') {
+      break;
+    }
+    ++p;
+  }
+}
+
+bool BristolReader::at_end() {
+  skip_space();
+  return p == end;
+}
+
+bool BristolReader::at_line_end() {
+  skip_blanks();
+  return p == end || *p == '\n';
+}
+
+// True if the next non-blank line holds a gate name, as gate lines do and
+// header lines do not.
+bool BristolReader::next_line_has_name() {
+  const char *q = p;
+  while (q < end && is_space(*q)) {
+    ++q;
+  }
+  for (; q < end && *q != '\n'; ++q) {
+    if ((*q >= 'A' && *q <= 'Z') || (*q >= 'a' && *q <= 'z')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int BristolReader::next_int(const char *what) {
+  skip_space();
+  if (p == end || *p < '0' || *p > '9') {
+    fail(std::string("expected ") + what);
+  }
+  long long value = 0;
+  do {
+    value = value * 10 + (*p++ - '0');
+    if (value > INT_MAX) {
+      fail(std::string(what) + " is too large");
+    }
+  } while (p < end && *p >= '0' && *p <= '9');
+  if (p < end && !is_space(*p)) {
+    fail(std::string("malformed ") + what);
+  }
+  return value;
+}
+
+std::string_view BristolReader::next_word() {
+  skip_space();
+  const char *word = p;
+  while (p < end && !is_space(*p)) {
+    ++p;
+  }
+  if (word == p) {
+    fail("expected a gate type");
+  }
+  return std::string_view(word, p - word);
+}
+
+// Reads the integers on the next non-blank line.
+std::vector<int> BristolReader::line_ints(const char *what) {
+  skip_space();
+  std::vector<int> values;
+  while (!at_line_end()) {
+    values.push_back(next_int(what));
+  }
+  return values;
+}
+
+/*
+ * Reads the header after the gate and wire counts. Bristol has one line with
+ * the two input lengths and the output length. Bristol Fashion has a line with
+ * the number of input groups and their lengths, then the same for outputs.
+ * They are told apart by whether the next line is a gate.
+ */
+void BristolReader::read_groups() {
+  std::vector<int> first = line_ints("input length");
+  if (next_line_has_name() || at_end()) {
+    if (first.size() != 3) {
+      fail("expected two input lengths and an output length");
+    }
+    input_groups = {first[0], first[1]};
+    output_groups = {first[2]};
+    return;
+  }
+
+  std::vector<int> second = line_ints("output length");
+  if (first.empty() || first.size() != (size_t)first[0] + 1) {
+    fail("expected the number of input groups and their lengths");
+  }
+  if (second.empty() || second.size() != (size_t)second[0] + 1) {
+    fail("expected the number of output groups and their lengths");
+  }
+  input_groups.assign(first.begin() + 1, first.end());
+  output_groups.assign(second.begin() + 1, second.end());
+}
+
+int BristolReader::read_wire(int wire) {
+  if (wire >= num_wire) {
+    fail("wire " + std::to_string(wire) + " is out of range");
+  }
+  if (!written[wire]) {
+    fail("wire " + std::to_string(wire) + " is read before it is set");
+  }
+  return wire;
+}
+
+int BristolReader::write_wire(int wire) {
+  if (wire >= num_wire) {
+    fail("wire " + std::to_string(wire) + " is out of range");
+  }
+  if (wire < input_length) {
+    fail("gate writes input wire " + std::to_string(wire));
+  }
+  if (written[wire]) {
+    fail("wire " + std::to_string(wire) + " is written twice");
+  }
+  written[wire] = true;
+  return wire;
+}
+
+void BristolReader::expect_arity(std::string_view type, int num_in,
+                                 int num_out, int want_in, int want_out) {
+  if (num_in != want_in || num_out != want_out) {
+    fail(std::string(type) + " gate needs " + std::to_string(want_in) +
+         " input(s) and " + std::to_string(want_out) + " output(s)");
+  }
+}
+
+void BristolReader::read_gate(std::vector<Gate> &gates) {
+  int num_in = next_int("gate input count");
+  int num_out = next_int("gate output count");
+  if (num_out > num_wire || num_in > 2 * (long long)num_wire + 2) {
+    fail("gate has more wires than the circuit");
+  }
+  wires.resize((size_t)num_in + num_out);
+  for (size_t k = 0; k < wires.size(); ++k) {
+    wires[k] = next_int("wire index");
+  }
+  const int *ins = wires.data();
+  const int *outs = wires.data() + num_in;
+  std::string_view type = next_word();
+
+  if (type == "AND" || type == "XOR") {
+    expect_arity(type, num_in, num_out, 2, 1);
+    int lhs = read_wire(ins[0]);
+    int rhs = read_wire(ins[1]);
+    GateType::T t = type == "AND" ? GateType::AND_GATE : GateType::XOR_GATE;
+    gates.push_back({t, lhs, rhs, write_wire(outs[0])});
+    if (t == GateType::AND_GATE) {
+      num_and_gate++;
+    }
+  } else if (type == "INV" || type == "NOT") {
+    expect_arity(type, num_in, num_out, 1, 1);
+    int lhs = read_wire(ins[0]);
+    gates.push_back({GateType::NOT_GATE, lhs, 0, write_wire(outs[0])});
+  } else if (type == "EQ") {
+    expect_arity(type, num_in, num_out, 1, 1);
+    if (ins[0] > 1) {
+      fail("EQ gate needs a constant of 0 or 1");
+    }
+    if (input_length == 0) {
+      fail("EQ gate needs at least one input wire");
+    }
+    int out = write_wire(outs[0]);
+    gates.push_back({GateType::XOR_GATE, 0, 0, out});
+    if (ins[0] == 1) {
+      gates.push_back({GateType::NOT_GATE, out, 0, out});
+    }
+  } else if (type == "EQW") {
+    expect_arity(type, num_in, num_out, 1, 1);
+    int lhs = read_wire(ins[0]);
+    int out = write_wire(outs[0]);
+    gates.push_back({GateType::NOT_GATE, lhs, 0, out});
+    gates.push_back({GateType::NOT_GATE, out, 0, out});
+  } else if (type == "MAND") {
+    if (num_out == 0 || num_in != 2 * num_out) {
+      fail("MAND gate needs 2k inputs and k outputs");
+    }
+    // All inputs are read before any output is written.
+    for (int k = 0; k < num_in; ++k) {
+      read_wire(ins[k]);
+    }
+    for (int k = 0; k < num_out; ++k) {
+      gates.push_back(
+          {GateType::AND_GATE, ins[k], ins[num_out + k], write_wire(outs[k])});
+    }
+    num_and_gate += num_out;
+  } else {
+    fail("unknown gate type " + std::string(type));
+  }
+}
+
+bool BristolReader::read_gates(std::vector<Gate> &gates, size_t max_lines) {
+  for (size_t n = 0; n < max_lines && lines_read < num_gate; ++n) {
+    if (at_end()) {
+      fail("expected " + std::to_string(num_gate) + " gates, found " +
+           std::to_string(lines_read));
+    }
+    read_gate(gates);
+    lines_read++;
+  }
+  if (lines_read < num_gate) {
+    return true;
+  }
+  if (!finished && !at_end()) {
+    fail("expected end of file after " + std::to_string(num_gate) + " gates");
+  }
+  finished = true;
+  return false;
+}
+
+/*
+ * Parse a circuit in Bristol or Bristol Fashion format from memory. Besides
+ * AND, XOR and INV (or NOT), this reads the Bristol Fashion gates
+ *
+ *   EQ c w      w = c for a constant c of 0 or 1, as XOR(0, 0) and maybe NOT
+ *   EQW a w     w = a, as two NOT gates
+ *   MAND        k ANDs a_i & b_i -> c_i with inputs a_1..a_k b_1..b_k and
+ *               outputs c_1..c_k, which all land in the same layer
+ *
+ * and checks that every gate has the right arity, reads only wires that are
+ * inputs or already written, writes only wires that are neither, and that the
+ * gate count matches the header. The checks are on the Bristol gates, so the
+ * lowering above may write its output twice.
+ * Errors name the file and line.
+ */
+Circuit parse_circuit_text(const char *data, size_t size,
+                           const std::string &name) {
+  BristolReader reader(data, size, name);
+  Circuit circuit;
+  circuit.num_wire = reader.num_wire;
+  circuit.input_length = reader.input_length;
+  circuit.output_length = reader.output_length;
+  circuit.input_groups = reader.input_groups;
+  circuit.output_groups = reader.output_groups;
+
+  // Every gate line takes at least 12 bytes, which bounds a bogus gate count.
+  circuit.gates.reserve(std::min<size_t>(reader.num_gate, size / 12 + 1));
+  reader.read_gates(circuit.gates, SIZE_MAX);
+  circuit.num_gate = circuit.gates.size();
+  circuit.num_and_gate = reader.num_and_gate;
+  return circuit;
+}
+
+/*
+ * Parse circuit from file in Bristol or Bristol Fashion format. The file is
+ * mapped and scanned in place rather than read through stdio.
+ */
+Circuit parse_circuit(std::string filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open circuit " + filename);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    throw std::runtime_error("Circuit file is empty: " + filename);
+  }
+  size_t size = st.st_size;
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("Could not map circuit " + filename);
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  try {
+    Circuit circuit = parse_circuit_text((const char *)data, size, filename);
+    munmap(data, size);
+    return circuit;
+  } catch (...) {
+    munmap(data, size);
+    throw;
+  }
+}
@@ -0,0 +1,251 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compiled_circuit.hpp"
+
+static_assert(sizeof(Gate) == 4 * sizeof(int32_t) &&
+                  std::is_trivially_copyable<Gate>::value,
+              "Gate must have a fixed layout to be mapped from disk");
+static_assert(sizeof(CircuitLayer) == 3 * sizeof(int32_t) &&
+                  std::is_trivially_copyable<CircuitLayer>::value,
+              "CircuitLayer must have a fixed layout to be mapped from disk");
+
+namespace {
+uint64_t checksum(const CompiledCircuitHeader &header,
+                  const uint32_t *output_groups, const CircuitLayer *layers,
+                  const Gate *gates) {
+  uint64_t hash = compiled_header_checksum(header);
+  hash = compiled_checksum(hash, output_groups,
+                           header.num_output_groups * sizeof(uint32_t));
+  hash = compiled_checksum(hash, layers,
+                           header.num_layers * sizeof(CircuitLayer));
+  return compiled_checksum(hash, gates, header.num_gate * sizeof(Gate));
+}
+} // namespace
+
+/*
+ * FNV-1a over size bytes, continuing from hash.
+ */
+uint64_t compiled_checksum(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/*
+ * FNV-1a over the header with its checksum field zeroed, which the checksums
+ * of the layers and gates continue from.
+ */
+uint64_t compiled_header_checksum(const CompiledCircuitHeader &header) {
+  CompiledCircuitHeader copy = header;
+  copy.checksum = 0;
+  return compiled_checksum(COMPILED_CHECKSUM_SEED, &copy, sizeof(copy));
+}
+
+/*
+ * Check the magic, version and counts of a compiled circuit header against
+ * the size of its file.
+ */
+void check_compiled_header(const CompiledCircuitHeader &header,
+                           size_t file_size, const std::string &filename) {
+  if (std::memcmp(header.magic, COMPILED_CIRCUIT_MAGIC,
+                  sizeof(COMPILED_CIRCUIT_MAGIC)) != 0 ||
+      header.version != COMPILED_CIRCUIT_VERSION) {
+    throw std::runtime_error("Not a compiled circuit: " + filename);
+  }
+  size_t expected_size = sizeof(CompiledCircuitHeader) +
+                         (size_t)header.num_output_groups * sizeof(uint32_t) +
+                         (size_t)header.num_layers * sizeof(CircuitLayer) +
+                         (size_t)header.num_gate * sizeof(Gate);
+  if (expected_size != file_size) {
+    throw std::runtime_error("Compiled circuit has the wrong size: " +
+                             filename);
+  }
+  if (header.input_length > header.num_wire ||
+      header.output_length > header.num_wire) {
+    throw std::runtime_error("Compiled circuit has invalid counts");
+  }
+}
+
+/*
+ * Read the output group lengths that follow a checked header, and check that
+ * they add up to the output length.
+ */
+std::vector<int> read_output_groups(const CompiledCircuitHeader &header) {
+  const uint32_t *lengths = (const uint32_t *)(&header + 1);
+  std::vector<int> output_groups(lengths, lengths + header.num_output_groups);
+  uint64_t total = 0;
+  for (uint32_t length : output_groups) {
+    total += length;
+  }
+  if (output_groups.empty() || total != header.output_length) {
+    throw std::runtime_error("Compiled circuit has invalid output groups");
+  }
+  return output_groups;
+}
+
+bool is_valid_gate(const Gate &g, int num_wire) {
+  bool valid_type = g.type == GateType::AND_GATE ||
+                    g.type == GateType::XOR_GATE ||
+                    g.type == GateType::NOT_GATE;
+  return valid_type && g.lhs >= 0 && g.lhs < num_wire && g.rhs >= 0 &&
+         g.rhs < num_wire && g.output >= 0 && g.output < num_wire;
+}
+
+/*
+ * Levelize a parsed circuit in memory and rename its wires to share slots.
+ */
+CompiledCircuit::CompiledCircuit(const Circuit &circuit)
+    : levelized(levelize_circuit(circuit)) {
+  num_wire = assign_wire_slots(levelized, circuit.num_wire,
+                               circuit.input_length, circuit.output_length);
+  input_length = circuit.input_length;
+  output_length = circuit.output_length;
+  output_groups = circuit.output_groups;
+  if (output_groups.empty()) {
+    output_groups = {output_length};
+  }
+  num_gate = levelized.gates.size();
+  num_and_gate = circuit.num_and_gate;
+  num_layers = levelized.layers.size();
+  gates = levelized.gates.data();
+  layers = levelized.layers.data();
+}
+
+/*
+ * Map a compiled circuit file. Checks the header, the checksum, and that every
+ * layer and gate stays within bounds, in one pass over the mapped arrays.
+ */
+CompiledCircuit::CompiledCircuit(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open compiled circuit " + filename);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CompiledCircuitHeader)) {
+    close(fd);
+    throw std::runtime_error("Compiled circuit is too short: " + filename);
+  }
+  mapping_size = st.st_size;
+  mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    mapping = nullptr;
+    throw std::runtime_error("Could not map compiled circuit " + filename);
+  }
+
+  try {
+    const CompiledCircuitHeader *header =
+        (const CompiledCircuitHeader *)mapping;
+    check_compiled_header(*header, mapping_size, filename);
+
+    num_wire = header->num_wire;
+    input_length = header->input_length;
+    output_length = header->output_length;
+    output_groups = read_output_groups(*header);
+    num_gate = header->num_gate;
+    num_and_gate = header->num_and_gate;
+    num_layers = header->num_layers;
+    const uint32_t *group_lengths = (const uint32_t *)(header + 1);
+    layers = (const CircuitLayer *)(group_lengths + output_groups.size());
+    gates = (const Gate *)(layers + num_layers);
+
+    if (checksum(*header, group_lengths, layers, gates) != header->checksum) {
+      throw std::runtime_error("Compiled circuit checksum mismatch: " +
+                               filename);
+    }
+
+    int previous_end = 0;
+    for (int d = 0; d < num_layers; ++d) {
+      const CircuitLayer &layer = layers[d];
+      if (layer.local_begin != previous_end ||
+          layer.and_begin < layer.local_begin || layer.end < layer.and_begin ||
+          layer.end > num_gate) {
+        throw std::runtime_error("Compiled circuit has invalid layers");
+      }
+      previous_end = layer.end;
+    }
+    if (previous_end != num_gate) {
+      throw std::runtime_error("Compiled circuit has invalid layers");
+    }
+
+    // Evaluation takes the gates of [and_begin, end) to be the ANDs, and
+    // sizes its triples and OTs from num_and_gate, so both must hold.
+    int and_count = 0;
+    for (int d = 0; d < num_layers; ++d) {
+      const CircuitLayer &layer = layers[d];
+      for (int k = layer.local_begin; k < layer.end; ++k) {
+        bool is_and = gates[k].type == GateType::AND_GATE;
+        if (!is_valid_gate(gates[k], num_wire) ||
+            is_and != (k >= layer.and_begin)) {
+          throw std::runtime_error("Compiled circuit has an invalid gate");
+        }
+        and_count += is_and;
+      }
+    }
+    if (and_count != num_and_gate) {
+      throw std::runtime_error("Compiled circuit has the wrong AND count");
+    }
+  } catch (...) {
+    munmap(mapping, mapping_size);
+    mapping = nullptr;
+    throw;
+  }
+}
+
+CompiledCircuit::~CompiledCircuit() {
+  if (mapping) {
+    munmap(mapping, mapping_size);
+  }
+}
+
+/*
+ * Check whether a file starts with the compiled circuit magic.
+ */
+bool CompiledCircuit::is_compiled(const std::string &filename) {
+  char magic[8] = {0};
+  std::ifstream in(filename, std::ios::binary);
+  in.read(magic, sizeof(magic));
+  return in.gcount() == sizeof(magic) &&
+         std::memcmp(magic, COMPILED_CIRCUIT_MAGIC,
+                     sizeof(COMPILED_CIRCUIT_MAGIC)) == 0;
+}
+
+/*
+ * Write the circuit in the compiled format.
+ */
+void CompiledCircuit::write(const std::string &filename) const {
+  CompiledCircuitHeader header = {};
+  std::memcpy(header.magic, COMPILED_CIRCUIT_MAGIC,
+              sizeof(COMPILED_CIRCUIT_MAGIC));
+  header.version = COMPILED_CIRCUIT_VERSION;
+  header.num_wire = num_wire;
+  header.input_length = input_length;
+  header.output_length = output_length;
+  header.num_gate = num_gate;
+  header.num_and_gate = num_and_gate;
+  header.num_layers = num_layers;
+  header.num_output_groups = output_groups.size();
+  std::vector<uint32_t> group_lengths(output_groups.begin(),
+                                      output_groups.end());
+  header.checksum = checksum(header, group_lengths.data(), layers, gates);
+
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  out.write((const char *)&header, sizeof(header));
+  out.write((const char *)group_lengths.data(),
+            group_lengths.size() * sizeof(uint32_t));
+  out.write((const char *)layers, num_layers * sizeof(CircuitLayer));
+  out.write((const char *)gates, num_gate * sizeof(Gate));
+  if (!out) {
+    throw std::runtime_error("Could not write compiled circuit " + filename);
+  }
+}
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compiled_circuit.hpp"
+#include "gate_stream.hpp"
+
+/*
+ * Map the file, read its header, and start the reader thread.
+ */
+GateStream::GateStream(const std::string &filename, size_t chunk_size,
+                       size_t read_ahead)
+    : filename(filename), chunk_size(chunk_size),
+      read_ahead(std::max<size_t>(read_ahead, 1)) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open circuit " + filename);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    throw std::runtime_error("Circuit file is empty: " + filename);
+  }
+  mapping_size = st.st_size;
+  mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    mapping = nullptr;
+    throw std::runtime_error("Could not map circuit " + filename);
+  }
+  madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+
+  try {
+    if (CompiledCircuit::is_compiled(filename)) {
+      if (mapping_size < sizeof(CompiledCircuitHeader)) {
+        throw std::runtime_error("Compiled circuit is too short: " + filename);
+      }
+      const CompiledCircuitHeader *header =
+          (const CompiledCircuitHeader *)mapping;
+      check_compiled_header(*header, mapping_size, filename);
+      num_wire = header->num_wire;
+      input_length = header->input_length;
+      output_length = header->output_length;
+      output_groups = read_output_groups(*header);
+      num_and_gate = header->num_and_gate;
+
+      // The layers are not needed to stream, but they are checksummed.
+      const uint32_t *group_lengths = (const uint32_t *)(header + 1);
+      const CircuitLayer *layers =
+          (const CircuitLayer *)(group_lengths + output_groups.size());
+      checksum = compiled_checksum(compiled_header_checksum(*header),
+                                   group_lengths,
+                                   output_groups.size() * sizeof(uint32_t));
+      checksum = compiled_checksum(checksum, layers,
+                                   header->num_layers * sizeof(CircuitLayer));
+      expected_checksum = header->checksum;
+      compiled_gates = (const Gate *)(layers + header->num_layers);
+      compiled_num_gate = header->num_gate;
+    } else {
+      reader = std::make_unique<BristolReader>((const char *)mapping,
+                                               mapping_size, filename);
+      num_wire = reader->num_wire;
+      input_length = reader->input_length;
+      output_length = reader->output_length;
+      output_groups = reader->output_groups;
+      num_and_gate = -1;
+    }
+  } catch (...) {
+    munmap(mapping, mapping_size);
+    throw;
+  }
+
+  reader_thread = std::thread(&GateStream::read_chunks, this);
+}
+
+GateStream::~GateStream() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  space_ready.notify_all();
+  reader_thread.join();
+  munmap(mapping, mapping_size);
+}
+
+bool GateStream::next(std::vector<Gate> &chunk) {
+  std::unique_lock<std::mutex> lock(mutex);
+  chunk_ready.wait(lock, [&] { return !chunks.empty() || finished; });
+  if (!chunks.empty()) {
+    chunk = std::move(chunks.front());
+    chunks.pop_front();
+    lock.unlock();
+    space_ready.notify_one();
+    return true;
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return false;
+}
+
+/*
+ * Read up to chunk_size gates into chunk. Returns false after the last one.
+ */
+bool GateStream::read_chunk(std::vector<Gate> &chunk) {
+  if (reader) {
+    bool more = reader->read_gates(chunk, chunk_size);
+    release_before(reader->offset());
+    return more;
+  }
+
+  size_t count = std::min(chunk_size, compiled_num_gate - compiled_next_gate);
+  const Gate *gates = compiled_gates + compiled_next_gate;
+  for (size_t k = 0; k < count; ++k) {
+    if (!is_valid_gate(gates[k], num_wire)) {
+      throw std::runtime_error("Compiled circuit has an invalid gate");
+    }
+    compiled_and_gates += gates[k].type == GateType::AND_GATE;
+  }
+  chunk.assign(gates, gates + count);
+  checksum = compiled_checksum(checksum, gates, count * sizeof(Gate));
+  compiled_next_gate += count;
+  release_before((const char *)(gates + count) - (const char *)mapping);
+
+  if (compiled_next_gate < compiled_num_gate) {
+    return true;
+  }
+  if (checksum != expected_checksum) {
+    throw std::runtime_error("Compiled circuit checksum mismatch: " +
+                             filename);
+  }
+  if (compiled_and_gates != num_and_gate) {
+    throw std::runtime_error("Compiled circuit has the wrong AND count");
+  }
+  return false;
+}
+
+/*
+ * Reader thread. Fills chunks until the circuit ends, an error occurs, or the
+ * stream is destroyed, waiting whenever read_ahead chunks are queued.
+ */
+void GateStream::read_chunks() {
+  try {
+    bool more = true;
+    while (more) {
+      std::vector<Gate> chunk;
+      chunk.reserve(chunk_size);
+      more = read_chunk(chunk);
+
+      std::unique_lock<std::mutex> lock(mutex);
+      space_ready.wait(lock,
+                       [&] { return stopping || chunks.size() < read_ahead; });
+      if (stopping) {
+        return;
+      }
+      if (!chunk.empty()) {
+        chunks.push_back(std::move(chunk));
+      }
+      finished = !more;
+      lock.unlock();
+      chunk_ready.notify_one();
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex);
+    error = std::current_exception();
+    finished = true;
+    chunk_ready.notify_one();
+  }
+}
+
+/*
+ * Drop the mapped pages before offset, which the reader is done with, so the
+ * stream's resident size does not grow with the file.
+ */
+void GateStream::release_before(size_t offset) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t end = offset / page * page;
+  if (end > released) {
+    madvise((char *)mapping + released, end - released, MADV_DONTNEED);
+    released = end;
+  }
+}
@@ -1,17 +1,23 @@
 #include "../include-shared/messages.hpp"
 
+#include "../include-shared/constants.hpp"
 #include "../include-shared/util.hpp"
 
-// ================================================
-// MESSAGE TYPES
-// ================================================
-
-/**
- * Get message type.
- */
-MessageType::T get_message_type(std::vector<unsigned char> &data)
+namespace
 {
-  return (MessageType::T)data[0];
+  // Every DL group element is sent as exactly this many big-endian bytes.
+  const size_t DL_ELEMENT_SIZE = DL_P.ByteCount();
+
+  /**
+   * Throws unless data holds at least n bytes starting at idx.
+   */
+  void check_remaining(std::vector<unsigned char> &data, int idx, size_t n)
+  {
+    if (idx < 0 || idx > data.size() || n > data.size() - idx)
+    {
+      throw std::runtime_error("Message ended unexpectedly");
+    }
+  }
 }
 
 // ================================================
@@ -19,45 +25,63 @@ MessageType::T get_message_type(std::vector<unsigned char> &data)
 // ================================================
 
 /**
- * Puts the bool b into the end of data.
+ * Puts the string s into the end of data, prefixed by its length.
  */
-int put_bool(bool b, std::vector<unsigned char> &data)
+int put_string(const std::string &s, std::vector<unsigned char> &data)
 {
-  data.push_back((char)b);
-  return 1;
+  int n = put_size(s.size(), data);
+  data.insert(data.end(), s.begin(), s.end());
+  return n + s.size();
 }
 
 /**
- * Puts the string s into the end of data.
+ * Puts the size n into the end of data as a LEB128 varint: seven bits per
+ * byte, low bits first, with the top bit set on every byte but the last.
  */
-int put_string(std::string s, std::vector<unsigned char> &data)
+int put_size(size_t n, std::vector<unsigned char> &data)
 {
-  // Put length
-  int idx = data.size();
-  data.resize(idx + sizeof(size_t));
-  size_t str_size = s.size();
-  std::memcpy(&data[idx], &str_size, sizeof(size_t));
-
-  // Put string
-  data.insert(data.end(), s.begin(), s.end());
-  return data.size() - idx;
+  int written = 0;
+  do
+  {
+    unsigned char byte = n & 0x7f;
+    n >>= 7;
+    data.push_back(n ? (byte | 0x80) : byte);
+    written++;
+  } while (n);
+  return written;
 }
 
 /**
- * Puts the integer i into the end of data.
+ * Puts a group element into the end of data as DL_ELEMENT_SIZE big-endian
+ * bytes, left-padded with zeros. No length is needed.
  */
-int put_integer(CryptoPP::Integer i, std::vector<unsigned char> &data)
+int put_element(const CryptoPP::SecByteBlock &element,
+                std::vector<unsigned char> &data)
 {
-  return put_string(CryptoPP::IntToString(i), data);
+  if (element.size() > DL_ELEMENT_SIZE)
+  {
+    throw std::runtime_error("Group element is too large to serialize");
+  }
+  data.insert(data.end(), DL_ELEMENT_SIZE - element.size(), 0);
+  data.insert(data.end(), element.begin(), element.end());
+  return DL_ELEMENT_SIZE;
 }
 
 /**
- * Puts the nest bool from data at index idx into b.
+ * Puts the bits into the end of data as their count followed by the bits
+ * packed eight to a byte, as in pack_bits.
  */
-int get_bool(bool *b, std::vector<unsigned char> &data, int idx)
+int put_bits(const std::vector<int> &bits, std::vector<unsigned char> &data)
 {
-  *b = (bool)data[idx];
-  return 1;
+  int n = put_size(bits.size(), data);
+  size_t idx = data.size();
+  size_t num_bytes = (bits.size() + 7) / 8;
+  data.resize(idx + num_bytes, 0);
+  for (size_t i = 0; i < bits.size(); i++)
+  {
+    data[idx + i / 8] |= (bits[i] & 1) << (i % 8);
+  }
+  return n + num_bytes;
 }
 
 /**
@@ -65,249 +89,100 @@ int get_bool(bool *b, std::vector<unsigned char> &data, int idx)
  */
 int get_string(std::string *s, std::vector<unsigned char> &data, int idx)
 {
-  // Get length
   size_t str_size;
-  std::memcpy(&str_size, &data[idx], sizeof(size_t));
-
-  // Get string
-  std::vector<unsigned char> svec(&data[idx + sizeof(size_t)],
-                                  &data[idx + sizeof(size_t) + str_size]);
-  *s = chvec2str(svec);
-  return sizeof(size_t) + str_size;
-}
-
-/**
- * Puts the next integer from data at index idx into i.
- */
-int get_integer(CryptoPP::Integer *i, std::vector<unsigned char> &data,
-                int idx)
-{
-  std::string i_str;
-  int n = get_string(&i_str, data, idx);
-  *i = CryptoPP::Integer(i_str.c_str());
-  return n;
-}
-
-// ================================================
-// WRAPPERS
-// ================================================
-
-void FinalGossip_Message::serialize(std::vector<unsigned char> &data)
-{
-  data.push_back((char)MessageType::FinalGossip_Message);
-  put_string(this->bit_string, data);
-}
-
-int FinalGossip_Message::deserialize(std::vector<unsigned char> &data)
-{
-  assert(data[0] == MessageType::FinalGossip_Message);
-
-  std::string bit_string;
-  int n = 1;
-  n += get_string(&bit_string, data, n);
-  this->bit_string = bit_string;
-
-  return n;
-}
-
-void InitialShare_Message::serialize(std::vector<unsigned char> &data)
-{
-  data.push_back((char)MessageType::InitialShare_Message);
-
-  put_string(std::to_string(this->share_value), data);
-}
-
-int InitialShare_Message::deserialize(std::vector<unsigned char> &data)
-{
-  assert(data[0] == MessageType::InitialShare_Message);
-
-  std::string share_value_string;
-  int n = 1;
-  n += get_string(&share_value_string, data, n);
-  this->share_value = std::stoi(share_value_string);
-
-  return n;
-}
-
-/**
- * serialize HMACTagged_Wrapper.
- */
-void HMACTagged_Wrapper::serialize(std::vector<unsigned char> &data)
-{
-  // Add message type.
-  data.push_back((char)MessageType::HMACTagged_Wrapper);
-
-  // Add fields.
-  put_string(chvec2str(this->payload), data);
+  int n = get_size(&str_size, data, idx);
+  check_remaining(data, idx + n, str_size);
 
-  std::string iv = byteblock_to_string(this->iv);
-  put_string(iv, data);
-
-  put_string(this->mac, data);
+  // Get string, copying straight out of data
+  s->assign((const char *)data.data() + idx + n, str_size);
+  return n + str_size;
 }
 
 /**
- * deserialize HMACTagged_Wrapper.
+ * Puts the next size from data at index idx into n.
  */
-int HMACTagged_Wrapper::deserialize(std::vector<unsigned char> &data)
+int get_size(size_t *n, std::vector<unsigned char> &data, int idx)
 {
-  // Check correct message type.
-  assert(data[0] == MessageType::HMACTagged_Wrapper);
-
-  // Get fields.
-  std::string payload_string;
-  int n = 1;
-  n += get_string(&payload_string, data, n);
-  this->payload = str2chvec(payload_string);
-
-  std::string iv;
-  n += get_string(&iv, data, n);
-  this->iv = string_to_byteblock(iv);
-
-  n += get_string(&this->mac, data, n);
-  return n;
+  *n = 0;
+  int read = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+  {
+    check_remaining(data, idx + read, 1);
+    unsigned char byte = data[idx + read++];
+    *n |= (size_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+    {
+      return read;
+    }
+  }
+  throw std::runtime_error("Size in message is too long");
 }
 
-// ================================================
-// KEY EXCHANGE
-// ================================================
-
 /**
- * serialize DHPublicValue_Message.
+ * Puts the next group element from data at index idx into element.
  */
-void DHPublicValue_Message::serialize(std::vector<unsigned char> &data)
+int get_element(CryptoPP::SecByteBlock *element,
+                std::vector<unsigned char> &data, int idx)
 {
-  // Add message type.
-  data.push_back((char)MessageType::DHPublicValue_Message);
-
-  // Add fields.
-  std::string public_string = byteblock_to_string(this->public_value);
-  put_string(public_string, data);
+  check_remaining(data, idx, DL_ELEMENT_SIZE);
+  element->Assign(&data[idx], DL_ELEMENT_SIZE);
+  return DL_ELEMENT_SIZE;
 }
 
 /**
- * deserialize DHPublicValue_Message.
+ * Puts the next packed bits from data at index idx into bits.
  */
-int DHPublicValue_Message::deserialize(std::vector<unsigned char> &data)
+int get_bits(std::vector<int> *bits, std::vector<unsigned char> &data,
+             int idx)
 {
-  // Check correct message type.
-  assert(data[0] == MessageType::DHPublicValue_Message);
+  size_t num_bits;
+  int n = get_size(&num_bits, data, idx);
+  size_t num_bytes = (num_bits + 7) / 8;
+  if (num_bits > num_bytes * 8)
+  {
+    throw std::runtime_error("Bit count in message is too large");
+  }
+  check_remaining(data, idx + n, num_bytes);
 
-  // Get fields.
-  std::string public_string;
-  int n = 1;
-  n += get_string(&public_string, data, n);
-  this->public_value = string_to_byteblock(public_string);
-  return n;
+  const unsigned char *packed = &data[idx + n];
+  bits->resize(num_bits);
+  for (size_t i = 0; i < num_bits; i++)
+  {
+    (*bits)[i] = (packed[i / 8] >> (i % 8)) & 1;
+  }
+  return n + num_bytes;
 }
 
 // ================================================
-// OBLIVIOUS TRANSFER
+// FIELD VISITORS
 // ================================================
 
-void SenderToReceiver_OTPublicValue_Message::serialize(
-    std::vector<unsigned char> &data)
-{
-  // Add message type.
-  data.push_back((char)MessageType::SenderToReceiver_OTPublicValue_Message);
-
-  // Add fields.
-  std::string public_integer = byteblock_to_string(this->public_value);
-  put_string(public_integer, data);
-}
-
-int SenderToReceiver_OTPublicValue_Message::deserialize(
-    std::vector<unsigned char> &data)
+void MessageWriter::bytes(const std::vector<unsigned char> &v)
 {
-  // Check correct message type.
-  assert(data[0] == MessageType::SenderToReceiver_OTPublicValue_Message);
-
-  // Get fields.
-  std::string public_integer;
-  int n = 1;
-  n += get_string(&public_integer, data, n);
-  this->public_value = string_to_byteblock(public_integer);
-  return n;
+  put_size(v.size(), data);
+  data.insert(data.end(), v.begin(), v.end());
 }
 
-void ReceiverToSender_OTPublicValue_Message::serialize(
-    std::vector<unsigned char> &data)
+void MessageWriter::bytes(const CryptoPP::SecByteBlock &b)
 {
-  // Add message type.
-  data.push_back((char)MessageType::ReceiverToSender_OTPublicValue_Message);
-
-  // Add fields.
-  std::string public_integer = byteblock_to_string(this->public_value);
-  put_string(public_integer, data);
+  put_size(b.size(), data);
+  data.insert(data.end(), b.begin(), b.end());
 }
 
-int ReceiverToSender_OTPublicValue_Message::deserialize(
-    std::vector<unsigned char> &data)
+void MessageReader::bytes(std::vector<unsigned char> &v)
 {
-  // Check correct message type.
-  assert(data[0] == MessageType::ReceiverToSender_OTPublicValue_Message);
-
-  // Get fields.
-  std::string public_integer;
-  int n = 1;
-  n += get_string(&public_integer, data, n);
-  this->public_value = string_to_byteblock(public_integer);
-  return n;
+  size_t length;
+  idx += get_size(&length, data, idx);
+  check_remaining(data, idx, length);
+  v.assign(data.begin() + idx, data.begin() + idx + length);
+  idx += length;
 }
 
-void SenderToReceiver_OTEncryptedValues_Message::serialize(
-    std::vector<unsigned char> &data)
+void MessageReader::bytes(CryptoPP::SecByteBlock &b)
 {
-  // Add message type.
-  data.push_back((char)MessageType::SenderToReceiver_OTEncryptedValues_Message);
-
-  // Add the # of encrypted values
-  int idx = data.size();
-  // Resize data to have space for the value of encryptions.size(). Since data
-  // contains data of 1 byte each, we just add sizeof(size_t) more elements
-  data.resize(idx + sizeof(size_t));
-  size_t num_encryptions = encryptions.size();
-  // Copy num_encryptions into data[idx]
-  std::memcpy(&data[idx], &num_encryptions, sizeof(size_t));
-
-  // Put each encryption.
-  for (auto &s : encryptions)
-  {
-    put_string(s, data);
-  }
-
-  // Put each IV. Note that the # of encryptions = # of IVs, so there's no need
-  // to add the number for this
-  for (auto &iv_block : ivs)
-  {
-    std::string iv_string = byteblock_to_string(iv_block);
-    put_string(iv_string, data);
-  }
+  size_t length;
+  idx += get_size(&length, data, idx);
+  check_remaining(data, idx, length);
+  b.Assign(&data[idx], length);
+  idx += length;
 }
-
-int SenderToReceiver_OTEncryptedValues_Message::deserialize(
-    std::vector<unsigned char> &data)
-{
-  // Check correct message type.
-  assert(data[0] == MessageType::SenderToReceiver_OTEncryptedValues_Message);
-
-  // Get length
-  size_t num_encryptions;
-  std::memcpy(&num_encryptions, &data[1], sizeof(size_t));
-
-  // Get fields. Note that n is the current index into data
-  int n = 1 + sizeof(size_t);
-  for (int i = 0; i < num_encryptions; i++)
-  {
-    std::string s;
-    n += get_string(&s, data, n);
-    encryptions.push_back(s);
-  }
-  for (int i = 0; i < num_encryptions; i++)
-  {
-    std::string iv;
-    n += get_string(&iv, data, n);
-    ivs.push_back(string_to_byteblock(iv));
-  }
-  return n;
-}
\ No newline at end of file
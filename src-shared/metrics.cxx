@@ -0,0 +1,107 @@
+#include <fstream>
+#include <stdexcept>
+
+#include "metrics.hpp"
+
+namespace {
+void write_link(std::ostream &out, const LinkMetrics &m) {
+  out << "\"bytes_sent\": " << m.bytes_sent
+      << ", \"bytes_received\": " << m.bytes_received
+      << ", \"messages_sent\": " << m.messages_sent
+      << ", \"messages_received\": " << m.messages_received
+      << ", \"crypto_seconds\": " << m.crypto_ns / 1e9
+      << ", \"wait_seconds\": " << m.wait_ns / 1e9
+      << ", \"base_ots\": " << m.base_ots
+      << ", \"random_ots\": " << m.random_ots
+      << ", \"derandomized_ots\": " << m.derandomized_ots;
+}
+} // namespace
+
+LinkMetrics LinkMetrics::operator-(const LinkMetrics &other) const {
+  LinkMetrics d;
+  d.bytes_sent = bytes_sent - other.bytes_sent;
+  d.bytes_received = bytes_received - other.bytes_received;
+  d.messages_sent = messages_sent - other.messages_sent;
+  d.messages_received = messages_received - other.messages_received;
+  d.wait_ns = wait_ns - other.wait_ns;
+  d.crypto_ns = crypto_ns - other.crypto_ns;
+  d.base_ots = base_ots - other.base_ots;
+  d.random_ots = random_ots - other.random_ots;
+  d.derandomized_ots = derandomized_ots - other.derandomized_ots;
+  return d;
+}
+
+LinkMetrics &LinkMetrics::operator+=(const LinkMetrics &other) {
+  bytes_sent += other.bytes_sent;
+  bytes_received += other.bytes_received;
+  messages_sent += other.messages_sent;
+  messages_received += other.messages_received;
+  wait_ns += other.wait_ns;
+  crypto_ns += other.crypto_ns;
+  base_ots += other.base_ots;
+  random_ots += other.random_ots;
+  derandomized_ots += other.derandomized_ots;
+  return *this;
+}
+
+void PhaseMetrics::start(const std::string &name,
+                         const std::map<int, LinkMetrics> &links) {
+  current_name = name;
+  current_links = links;
+  current_start = std::chrono::steady_clock::now();
+}
+
+void PhaseMetrics::stop(const std::map<int, LinkMetrics> &links) {
+  Phase phase;
+  phase.name = current_name;
+  phase.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - current_start)
+                      .count();
+  for (const auto &[peer, now] : links) {
+    auto before = current_links.find(peer);
+    phase.peers[peer] =
+        before == current_links.end() ? now : now - before->second;
+  }
+  phases.push_back(std::move(phase));
+}
+
+/*
+ * Write every phase with its totals over all peers and its per-peer counts.
+ * Crypto and wait times are summed over peers, whose links run concurrently,
+ * so they can add up to more than the phase's wall time.
+ */
+void PhaseMetrics::write_json(const std::string &filename,
+                              int my_party) const {
+  std::ofstream out(filename, std::ios::trunc);
+  out << "{\"party\": " << my_party << ", \"phases\": [";
+  LinkMetrics run_total;
+  double run_seconds = 0;
+  for (size_t i = 0; i < phases.size(); ++i) {
+    const Phase &phase = phases[i];
+    LinkMetrics total;
+    for (const auto &[peer, m] : phase.peers) {
+      total += m;
+    }
+    run_total += total;
+    run_seconds += phase.seconds;
+
+    out << (i ? "," : "") << "\n  {\"name\": \"" << phase.name
+        << "\", \"seconds\": " << phase.seconds << ", ";
+    write_link(out, total);
+    out << ", \"peers\": {";
+    bool first = true;
+    for (const auto &[peer, m] : phase.peers) {
+      out << (first ? "" : ", ") << "\"" << peer << "\": {";
+      write_link(out, m);
+      out << "}";
+      first = false;
+    }
+    out << "}}";
+  }
+  out << "\n], \"total\": {\"seconds\": " << run_seconds << ", ";
+  write_link(out, run_total);
+  out << "}}\n";
+  if (!out) {
+    throw std::runtime_error("Could not write metrics to " + filename);
+  }
+}
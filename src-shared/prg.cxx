@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <crypto++/osrng.h>
+
+#include "prg.hpp"
+
+/*
+ * Seed from the OS.
+ */
+PRG::PRG() : buffer(PRG_BUFFER_SIZE), used(PRG_BUFFER_SIZE) {
+  CryptoPP::SecByteBlock seed(CryptoPP::AES::DEFAULT_KEYLENGTH);
+  CryptoPP::OS_GenerateRandomBlock(false, seed, seed.size());
+  CryptoPP::SecByteBlock iv(CryptoPP::AES::BLOCKSIZE);
+  std::memset(iv, 0, iv.size());
+  cipher.SetKeyWithIV(seed, seed.size(), iv, iv.size());
+}
+
+/*
+ * Expand a given seed, so two PRGs with the same seed agree.
+ */
+PRG::PRG(const CryptoPP::SecByteBlock &seed)
+    : buffer(PRG_BUFFER_SIZE), used(PRG_BUFFER_SIZE) {
+  if (seed.size() != CryptoPP::AES::DEFAULT_KEYLENGTH) {
+    throw std::runtime_error("PRG seed must be 16 bytes");
+  }
+  CryptoPP::SecByteBlock iv(CryptoPP::AES::BLOCKSIZE);
+  std::memset(iv, 0, iv.size());
+  cipher.SetKeyWithIV(seed, seed.size(), iv, iv.size());
+}
+
+/*
+ * This thread's PRG.
+ */
+PRG &PRG::local() {
+  thread_local PRG prg;
+  return prg;
+}
+
+void PRG::refill() {
+  std::memset(buffer, 0, buffer.size());
+  cipher.ProcessString(buffer, buffer.size());
+  used = 0;
+}
+
+/*
+ * Copy out buffered keystream. Requests larger than the buffer skip it and
+ * take the keystream directly.
+ */
+void PRG::GenerateBlock(CryptoPP::byte *output, size_t size) {
+  size_t available = buffer.size() - used;
+  if (size > available && size - available >= buffer.size()) {
+    std::memcpy(output, buffer.data() + used, available);
+    used = buffer.size();
+    std::memset(output + available, 0, size - available);
+    cipher.ProcessString(output + available, size - available);
+    return;
+  }
+  while (size > 0) {
+    if (used == buffer.size()) {
+      refill();
+    }
+    size_t n = std::min(size, buffer.size() - used);
+    std::memcpy(output, buffer.data() + used, n);
+    used += n;
+    output += n;
+    size -= n;
+  }
+}
+
+unsigned int PRG::GenerateBit() { return generate_bit(); }
+
+int PRG::generate_bit() {
+  if (bits_left == 0) {
+    bit_word = generate_word();
+    bits_left = 64;
+  }
+  int bit = bit_word & 1;
+  bit_word >>= 1;
+  bits_left--;
+  return bit;
+}
+
+uint64_t PRG::generate_word() {
+  uint64_t word;
+  GenerateBlock((CryptoPP::byte *)&word, sizeof(word));
+  return word;
+}
+
+void PRG::generate_words(uint64_t *words, size_t n) {
+  GenerateBlock((CryptoPP::byte *)words, n * sizeof(uint64_t));
+}
+
+/*
+ * n random bits, one per int, unpacked from whole words.
+ */
+std::vector<int> PRG::generate_bits(size_t n) {
+  std::vector<uint64_t> words((n + 63) / 64);
+  generate_words(words.data(), words.size());
+  std::vector<int> bits(n);
+  for (size_t i = 0; i < n; ++i) {
+    bits[i] = (words[i / 64] >> (i % 64)) & 1;
+  }
+  return bits;
+}
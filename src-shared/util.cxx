@@ -1,14 +1,14 @@
 #include "../include-shared/util.hpp"
+#include "../include-shared/prg.hpp"
 
 #include <crypto++/rng.h>
-#include <crypto++/osrng.h>
 
 using namespace CryptoPP;
 
 /**
  * Convert char vec to string.
  */
-std::string chvec2str(std::vector<unsigned char> data)
+std::string chvec2str(const std::vector<unsigned char> &data)
 {
   std::string s(data.begin(), data.end());
   return s;
@@ -17,7 +17,7 @@ std::string chvec2str(std::vector<unsigned char> data)
 /**
  * Convert string to char vec.
  */
-std::vector<unsigned char> str2chvec(std::string s)
+std::vector<unsigned char> str2chvec(const std::string &s)
 {
   std::vector<unsigned char> v(s.begin(), s.end());
   return v;
@@ -139,12 +139,42 @@ std::pair<std::string, int> parse_addr(std::string str)
 }
 
 /**
- * Generates a random bit.
+ * Generates a random bit from this thread's PRG.
  */
 int generate_bit()
 {
-  CryptoPP::AutoSeededRandomPool rng;
-  return rng.GenerateBit();
+  return PRG::local().generate_bit();
+}
+
+/**
+ * Packs a vector of bits into a string, eight bits per byte.
+ */
+std::string pack_bits(const std::vector<int> &bits)
+{
+  std::string packed((bits.size() + 7) / 8, 0);
+  for (size_t i = 0; i < bits.size(); i++)
+  {
+    packed[i / 8] |= (bits[i] & 1) << (i % 8);
+  }
+  return packed;
+}
+
+/**
+ * Unpacks the first num_bits bits of a string built by pack_bits.
+ */
+std::vector<int> unpack_bits(const std::string &packed, size_t num_bits)
+{
+  if (packed.size() * 8 < num_bits)
+  {
+    throw std::runtime_error("unpack_bits: not enough packed bits");
+  }
+
+  std::vector<int> bits(num_bits);
+  for (size_t i = 0; i < num_bits; i++)
+  {
+    bits[i] = (packed[i / 8] >> (i % 8)) & 1;
+  }
+  return bits;
 }
 
 /**
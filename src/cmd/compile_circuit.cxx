@@ -0,0 +1,33 @@
+#include <iostream>
+#include <string>
+
+#include "../../include-shared/circuit.hpp"
+#include "../../include-shared/circuit_optimizer.hpp"
+#include "../../include-shared/compiled_circuit.hpp"
+
+/*
+ * Usage: ./compile_circuit <bristol circuit file> <output file>
+ *
+ * Optimizes and levelizes a Bristol circuit and writes it in the compiled
+ * format, which participant can map directly instead of parsing.
+ */
+int main(int argc, char *argv[])
+{
+  if (argc != 3)
+  {
+    std::cout << "Usage: ./compile_circuit <bristol circuit file> <output file>"
+              << std::endl;
+    return 1;
+  }
+
+  OptimizerReport report;
+  CompiledCircuit compiled(optimize_circuit(parse_circuit(argv[1]), &report));
+  compiled.write(argv[2]);
+
+  std::cout << "Compiled " << argv[1] << " to " << argv[2] << ": "
+            << compiled.num_gate << " gates (" << report.and_gates_before
+            << " -> " << report.and_gates_after << " AND gates) in "
+            << compiled.num_layers << " layers, " << compiled.num_wire << " share slots"
+            << std::endl;
+  return 0;
+}
@@ -1,20 +1,505 @@
+#include <climits>
 #include <cmath>
 #include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <atomic>
+#include <exception>
 #include <future>
+#include <type_traits>
 #include <thread> // std::this_thread::sleep_for
 #include <chrono> // std::chrono::seconds
 
+#include "../../include-shared/bit_vector.hpp"
 #include "../../include-shared/circuit.hpp"
+#include "../../include-shared/circuit_optimizer.hpp"
+#include "../../include-shared/compiled_circuit.hpp"
+#include "../../include-shared/gate_stream.hpp"
 #include "../../include-shared/logger.hpp"
+#include "../../include-shared/metrics.hpp"
+#include "../../include-shared/prg.hpp"
 #include "../../include-shared/util.hpp"
 #include "../../include/pkg/peer_link.hpp"
 #include "../../include/drivers/share_driver.hpp"
 
 /*
- * Usage: ./participant <circuit file> <input file> <address> <port>
+ * Run fn(other_party, peer_link) with every peer at once, on each link's
+ * worker thread, and wait for all of them. Each PeerLink has its own socket,
+ * so the exchanges with different peers proceed independently and the total
+ * latency is that of the slowest peer. Returns the results in the iteration
+ * order of peer_links.
+ *
+ * If fn throws for one peer, every link is closed, so the exchanges still
+ * waiting on other peers fail rather than hang, and those peers see the
+ * connection drop. The first error is rethrown once all have stopped.
+ */
+template <typename F>
+auto run_with_each_peer(std::unordered_map<int, PeerLink> &peer_links, F fn)
+{
+  using Result = std::invoke_result_t<F, int, PeerLink &>;
+  std::vector<std::future<Result>> futures;
+  std::atomic<bool> failed = false;
+  std::exception_ptr first_error;
+  for (auto &[other_party, pl] : peer_links)
+  {
+    auto promise = std::make_shared<std::promise<Result>>();
+    futures.push_back(promise->get_future());
+    pl.Post([&, promise, i = other_party, &link = pl]()
+            {
+      try
+      {
+        if constexpr (std::is_void_v<Result>)
+        {
+          fn(i, link);
+          promise->set_value();
+        }
+        else
+        {
+          promise->set_value(fn(i, link));
+        }
+      }
+      catch (...)
+      {
+        if (!failed.exchange(true))
+        {
+          first_error = std::current_exception();
+          for (auto &[j, other] : peer_links)
+          {
+            other.Close();
+          }
+        }
+        promise->set_exception(std::current_exception());
+      } });
+  }
+
+  for (auto &f : futures)
+  {
+    f.wait();
+  }
+  if (first_error)
+  {
+    std::rethrow_exception(first_error);
+  }
+  if constexpr (std::is_void_v<Result>)
+  {
+    for (auto &f : futures)
+    {
+      f.get();
+    }
+  }
+  else
+  {
+    std::vector<Result> results;
+    for (auto &f : futures)
+    {
+      results.push_back(f.get());
+    }
+    return results;
+  }
+}
+
+/*
+ * Cumulative metrics of the link to every peer, for PhaseMetrics.
+ */
+std::map<int, LinkMetrics> link_metrics(std::unordered_map<int, PeerLink> &peer_links)
+{
+  std::map<int, LinkMetrics> links;
+  for (auto &[other_party, pl] : peer_links)
+  {
+    links[other_party] = pl.GetMetrics();
+  }
+  return links;
+}
+
+/*
+ * Evaluate a batch of independent AND gates given our shares of their inputs.
+ * For every pair of parties, the lower-indexed party acts as the OT sender and
+ * the other as the receiver, and each pair runs a single batched OT covering
+ * every gate in the batch. The OTs with different peers run concurrently.
+ */
+std::vector<int> evaluate_and_layer(std::unordered_map<int, PeerLink> &peer_links, int my_party,
+                                    const std::vector<int> &lefts, const std::vector<int> &rights)
+{
+  auto ot_responses = run_with_each_peer(peer_links, [&](int i, PeerLink &pl)
+                                         {
+    std::vector<int> response(lefts.size());
+    if (my_party < i)
+    {
+      std::vector<std::vector<int>> options;
+      response = PRG::local().generate_bits(lefts.size());
+      for (int k = 0; k < lefts.size(); k++)
+      {
+        int bit = response[k];
+        options.push_back({bit, bit ^ rights[k], bit ^ lefts[k], bit ^ lefts[k] ^ rights[k]});
+      }
+      pl.OT_send_batch(options);
+    }
+    else
+    {
+      // 0, 0 -> 0
+      // 1, 0 -> 1
+      // 0, 1 -> 2
+      // 1, 1 -> 3
+      std::vector<int> choice_bits;
+      for (int k = 0; k < lefts.size(); k++)
+      {
+        choice_bits.push_back(lefts[k] + (2 * rights[k]));
+      }
+      response = pl.OT_recv_batch(choice_bits);
+    }
+    return response; });
+
+  std::vector<int> ot_accumulator(lefts.size());
+  for (int k = 0; k < lefts.size(); k++)
+  {
+    ot_accumulator[k] = lefts[k] & rights[k];
+    for (auto &response : ot_responses)
+    {
+      ot_accumulator[k] ^= response[k];
+    }
+  }
+  return ot_accumulator;
+}
+
+/*
+ * Offline phase. Generate our shares of num_triples Beaver triples before the inputs are
+ * known. Every party samples its shares of a and b, and c = a & b is computed with the
+ * OT-based AND protocol above, all triples in a single batch.
+ */
+std::vector<BeaverTriple> generate_triples(std::unordered_map<int, PeerLink> &peer_links, ShareDriver &sd,
+                                           int my_party, int num_triples)
+{
+  std::vector<int> a = sd.generate_random_shares(num_triples);
+  std::vector<int> b = sd.generate_random_shares(num_triples);
+  std::vector<int> c = evaluate_and_layer(peer_links, my_party, a, b);
+
+  std::vector<BeaverTriple> triples(num_triples);
+  for (int k = 0; k < num_triples; k++)
+  {
+    triples[k] = {a[k], b[k], c[k]};
+  }
+  return triples;
+}
+
+/*
+ * Open secret-shared bits: send our shares to every peer and XOR together everyone's
+ * shares. Sends are queued without blocking, so both sides of each pair send first
+ * and then receive. All pairs run concurrently.
+ */
+std::vector<int> open_shares(std::unordered_map<int, PeerLink> &peer_links, int my_party,
+                             const std::vector<int> &bits)
+{
+  auto all_bits = run_with_each_peer(peer_links, [&](int i, PeerLink &pl)
+                                     {
+    pl.SendMaskedShares(bits);
+    std::vector<int> their_bits = pl.ReceiveMaskedShares();
+    if (their_bits.size() != bits.size())
+    {
+      throw std::runtime_error("Received wrong number of masked shares");
+    }
+    return their_bits; });
+
+  std::vector<int> opened = bits;
+  for (auto &their_bits : all_bits)
+  {
+    for (int k = 0; k < bits.size(); k++)
+    {
+      opened[k] ^= their_bits[k];
+    }
+  }
+  return opened;
+}
+
+/*
+ * Online phase. Evaluate a batch of independent AND gates by consuming one Beaver triple
+ * per gate, starting at triples[next_triple]. The only communication is opening
+ * d = x ^ a and e = y ^ b for every gate.
+ */
+std::vector<int> evaluate_and_layer_with_triples(std::unordered_map<int, PeerLink> &peer_links, ShareDriver &sd,
+                                                 int my_party, const std::vector<int> &lefts, const std::vector<int> &rights,
+                                                 const std::vector<BeaverTriple> &triples, int &next_triple)
+{
+  int num_gates = lefts.size();
+  if (next_triple + num_gates > triples.size())
+  {
+    throw std::runtime_error("Ran out of Beaver triples");
+  }
+
+  // Masked shares of all d values, followed by all e values.
+  std::vector<int> masked(2 * num_gates);
+  for (int k = 0; k < num_gates; k++)
+  {
+    auto [d, e] = sd.beaver_mask(lefts[k], rights[k], triples[next_triple + k]);
+    masked[k] = d;
+    masked[num_gates + k] = e;
+  }
+
+  std::vector<int> opened = open_shares(peer_links, my_party, masked);
+
+  std::vector<int> outputs(num_gates);
+  for (int k = 0; k < num_gates; k++)
+  {
+    outputs[k] = sd.beaver_combine(opened[k], opened[num_gates + k], triples[next_triple + k]);
+  }
+  next_triple += num_gates;
+  return outputs;
+}
+
+/*
+ * Evaluate a levelized circuit one layer at a time. Local gates need no
+ * communication, and every AND of a layer, over all instances, shares one
+ * round. Each layer is its own metrics phase.
+ */
+void evaluate_layers(const CompiledCircuit &circuit, WireShares &shares,
+                     std::unordered_map<int, PeerLink> &peer_links, ShareDriver &sd, int my_party,
+                     const std::vector<BeaverTriple> &triples, int &next_triple, PhaseMetrics &metrics)
+{
+  int num_instances = shares.instances();
+  for (int d = 0; d < circuit.num_layers; d++)
+  {
+    const CircuitLayer &layer = circuit.layers[d];
+    metrics.start("layer " + std::to_string(d), link_metrics(peer_links));
+
+    // XOR and NOT gates need no communication. Runs of gates over consecutive
+    // wires are evaluated a word at a time.
+    for (const GateRun &run : find_gate_runs(circuit.gates, layer.local_begin, layer.and_begin))
+    {
+      if (run.type == GateType::XOR_GATE)
+      {
+        shares.xor_wires(run.output, run.lhs, run.rhs, run.length);
+      }
+      else if (run.type == GateType::NOT_GATE)
+      {
+        shares.not_wires(run.output, run.lhs, run.length, my_party == 0);
+      }
+      else
+      {
+        throw std::runtime_error("Invalid gate type found");
+      }
+    }
+
+    // Every AND gate of the layer, over all instances, shares a single round.
+    if (layer.and_begin == layer.end)
+    {
+      metrics.stop(link_metrics(peer_links));
+      continue;
+    }
+    std::cerr << "Layer " << d << ": evaluating " << layer.end - layer.and_begin << " AND gates" << std::endl;
+
+    std::vector<int> lefts, rights;
+    for (int k = layer.and_begin; k < layer.end; k++)
+    {
+      for (int t = 0; t < num_instances; t++)
+      {
+        lefts.push_back(shares.get(circuit.gates[k].lhs, t));
+        rights.push_back(shares.get(circuit.gates[k].rhs, t));
+      }
+    }
+
+    std::vector<int> outputs = evaluate_and_layer_with_triples(peer_links, sd, my_party, lefts, rights,
+                                                               triples, next_triple);
+    for (int k = layer.and_begin; k < layer.end; k++)
+    {
+      for (int t = 0; t < num_instances; t++)
+      {
+        shares.set(circuit.gates[k].output, t, outputs[(k - layer.and_begin) * num_instances + t]);
+      }
+    }
+    metrics.stop(link_metrics(peer_links));
+  }
+}
+
+/*
+ * Streaming evaluation. Gates arrive in file order and are evaluated as they
+ * come: runs of XOR and NOT gates at once, and AND gates queued into a batch
+ * that is opened in one round. A queued AND copies its input shares, so only
+ * its output is pending; the batch is flushed when a gate reads or overwrites
+ * a pending wire, or when it reaches GATE_STREAM_CHUNK_SIZE gates. A compiled
+ * circuit streams layer by layer, so this costs one round per layer, and the
+ * stream reads the next chunks while a round is in flight.
+ *
+ * If the stream does not know its AND count, triples are generated as the
+ * batches need them, in blocks that grow with the number used so far.
+ *
+ * Each batch, with any triples generated for it, is its own metrics phase.
+ */
+void evaluate_stream(GateStream &stream, WireShares &shares,
+                     std::unordered_map<int, PeerLink> &peer_links, ShareDriver &sd, int my_party,
+                     std::vector<BeaverTriple> &triples, int &next_triple, PhaseMetrics &metrics)
+{
+  int num_instances = shares.instances();
+  std::vector<bool> pending(stream.num_wire, false);
+  std::vector<int> and_outputs, lefts, rights;
+  int triples_generated = 0;
+  int num_batches = 0;
+
+  auto flush = [&]()
+  {
+    if (and_outputs.empty())
+    {
+      return;
+    }
+    metrics.start("batch " + std::to_string(num_batches++), link_metrics(peer_links));
+    int needed = lefts.size();
+    if (next_triple + needed > triples.size())
+    {
+      triples.erase(triples.begin(), triples.begin() + next_triple);
+      next_triple = 0;
+      // Blocks double up to a chunk's worth, so small circuits stay cheap.
+      int block = std::min<int>(triples_generated, GATE_STREAM_CHUNK_SIZE * num_instances);
+      int num_new = std::max<int>(needed - triples.size(), block);
+      std::vector<BeaverTriple> more = generate_triples(peer_links, sd, my_party, num_new);
+      triples.insert(triples.end(), more.begin(), more.end());
+      triples_generated += num_new;
+    }
+
+    std::vector<int> outputs = evaluate_and_layer_with_triples(peer_links, sd, my_party, lefts, rights,
+                                                               triples, next_triple);
+    for (int k = 0; k < and_outputs.size(); k++)
+    {
+      for (int t = 0; t < num_instances; t++)
+      {
+        shares.set(and_outputs[k], t, outputs[k * num_instances + t]);
+      }
+      pending[and_outputs[k]] = false;
+    }
+    and_outputs.clear();
+    lefts.clear();
+    rights.clear();
+    metrics.stop(link_metrics(peer_links));
+  };
+
+  std::vector<Gate> chunk;
+  while (stream.next(chunk))
+  {
+    int k = 0;
+    while (k < chunk.size())
+    {
+      const Gate &g = chunk[k];
+      if (g.type != GateType::AND_GATE)
+      {
+        // A run of local gates. None of them reads a queued AND's inputs after
+        // they were copied, so the batch only has to go first if one of them
+        // touches a pending wire.
+        int begin = k;
+        bool needs_flush = false;
+        for (; k < chunk.size() && chunk[k].type != GateType::AND_GATE; k++)
+        {
+          const Gate &local = chunk[k];
+          needs_flush = needs_flush || pending[local.lhs] || pending[local.output] ||
+                        (local.type == GateType::XOR_GATE && pending[local.rhs]);
+        }
+        if (needs_flush)
+        {
+          flush();
+        }
+        for (const GateRun &run : find_gate_runs(chunk.data(), begin, k))
+        {
+          if (run.type == GateType::XOR_GATE)
+          {
+            shares.xor_wires(run.output, run.lhs, run.rhs, run.length);
+          }
+          else
+          {
+            shares.not_wires(run.output, run.lhs, run.length, my_party == 0);
+          }
+        }
+        continue;
+      }
+
+      if (pending[g.lhs] || pending[g.rhs] || pending[g.output])
+      {
+        flush();
+      }
+      for (int t = 0; t < num_instances; t++)
+      {
+        lefts.push_back(shares.get(g.lhs, t));
+        rights.push_back(shares.get(g.rhs, t));
+      }
+      and_outputs.push_back(g.output);
+      pending[g.output] = true;
+      if (and_outputs.size() >= GATE_STREAM_CHUNK_SIZE)
+      {
+        flush();
+      }
+      k++;
+    }
+  }
+  flush();
+}
+
+/*
+ * Decide which outputs each party reconstructs. spec lists the receiving parties
+ * of each output group, groups separated by '/' and parties by ',', so "0/1,2"
+ * sends the first group to party 0 and the second to parties 1 and 2. A spec
+ * with one group applies it to every group, and an empty spec sends every
+ * output to every party. Returns, for each party, the indices of the outputs
+ * it receives, in order.
+ */
+std::vector<std::vector<int>> parse_output_parties(const std::string &spec, const std::vector<int> &output_groups,
+                                                   int num_parties)
+{
+  std::vector<std::vector<int>> group_parties;
+  if (spec.empty())
+  {
+    std::vector<int> everyone;
+    for (int j = 0; j < num_parties; j++)
+    {
+      everyone.push_back(j);
+    }
+    group_parties.push_back(everyone);
+  }
+  else
+  {
+    for (auto &group : string_split(spec, '/'))
+    {
+      std::vector<int> parties;
+      for (auto &party : string_split(group, ','))
+      {
+        int j = std::stoi(party);
+        if (j < 0 || j >= num_parties)
+        {
+          throw std::runtime_error("Output party " + party + " does not exist");
+        }
+        parties.push_back(j);
+      }
+      group_parties.push_back(parties);
+    }
+  }
+  if (group_parties.size() != 1 && group_parties.size() != output_groups.size())
+  {
+    throw std::runtime_error("Output parties name " + std::to_string(group_parties.size()) +
+                             " groups, but the circuit has " + std::to_string(output_groups.size()));
+  }
+
+  std::vector<std::vector<int>> received(num_parties);
+  int first = 0;
+  for (int g = 0; g < output_groups.size(); g++)
+  {
+    for (int j : group_parties[group_parties.size() == 1 ? 0 : g])
+    {
+      for (int i = first; i < first + output_groups[g]; i++)
+      {
+        received[j].push_back(i);
+      }
+    }
+    first += output_groups[g];
+  }
+  return received;
+}
+
+/*
+ * Usage: ./participant [--stream] [--output-parties <spec>] [--metrics <file>] <addr file> <circuit file> <input file> <my party> [more input files...]
+ *
+ * Every input file is one instance of the circuit. All instances are evaluated
+ * together, with each wire holding one share per instance. With --stream, the
+ * circuit is read and evaluated in chunks instead of being loaded whole. With
+ * --output-parties, only the given parties learn the outputs (see
+ * parse_output_parties); every party must pass the same spec. With --metrics,
+ * the time, traffic and OTs of every phase are written to the given file as
+ * JSON (see PhaseMetrics).
  */
 int main(int argc, char *argv[])
 {
@@ -24,34 +509,128 @@ int main(int argc, char *argv[])
   // ======================
   // INPUT PARSING
   // ======================
-  if (!(argc == 5))
+  bool streaming = false;
+  std::string output_parties_spec;
+  std::string metrics_file;
+  while (argc > 1 && std::string(argv[1]).rfind("--", 0) == 0)
+  {
+    std::string option = argv[1];
+    if (option == "--stream")
+    {
+      streaming = true;
+    }
+    else if (option == "--output-parties" && argc > 2)
+    {
+      output_parties_spec = argv[2];
+      argc--;
+      argv++;
+    }
+    else if (option == "--metrics" && argc > 2)
+    {
+      metrics_file = argv[2];
+      argc--;
+      argv++;
+    }
+    else
+    {
+      argc = 0;
+      break;
+    }
+    argc--;
+    argv++;
+  }
+  if (argc < 5)
   {
     std::cout
-        << "Usage: ./participant <addr file> <circuit file> <input file> <my party>"
+        << "Usage: ./participant [--stream] [--output-parties <spec>] [--metrics <file>] <addr file> <circuit file> <input file> <my party> [more input files...]"
         << std::endl;
     return 1;
   }
   std::string addr_file = argv[1];
   std::string circuit_file = argv[2];
-  std::string input_file = argv[3];
+  std::vector<std::string> input_files = {argv[3]};
   int my_party = std::stoi(argv[4]);
+  for (int i = 5; i < argc; i++)
+  {
+    input_files.push_back(argv[i]);
+  }
 
-  Circuit circuit = parse_circuit(circuit_file);
+  // A compiled circuit (see compile_circuit) is mapped and used as is. A
+  // Bristol file is optimized and levelized here; every party runs the same
+  // deterministic passes, so all agree on the result. A streamed circuit is
+  // evaluated as it is read, without either.
+  std::unique_ptr<CompiledCircuit> compiled;
+  std::unique_ptr<GateStream> gate_stream;
+  if (streaming)
+  {
+    gate_stream = std::make_unique<GateStream>(circuit_file);
+  }
+  else if (CompiledCircuit::is_compiled(circuit_file))
+  {
+    compiled = std::make_unique<CompiledCircuit>(circuit_file);
+  }
+  else
+  {
+    OptimizerReport report;
+    compiled = std::make_unique<CompiledCircuit>(optimize_circuit(parse_circuit(circuit_file), &report));
+    std::cout << "Optimized circuit: " << report.and_gates_before << " -> "
+              << report.and_gates_after << " AND gates, " << report.gates_before
+              << " -> " << report.gates_after << " gates" << std::endl;
+  }
+  int num_wire = gate_stream ? gate_stream->num_wire : compiled->num_wire;
+  int output_length = gate_stream ? gate_stream->output_length : compiled->output_length;
+  long long num_and_gate = gate_stream ? gate_stream->num_and_gate : compiled->num_and_gate;
+  const std::vector<int> &output_groups = gate_stream ? gate_stream->output_groups : compiled->output_groups;
+
+  // One input per instance. Every instance must agree on who owns each wire.
+  std::vector<std::vector<InitialWireInput>> inputs;
+  for (auto &input_file : input_files)
+  {
+    inputs.push_back(parse_input(input_file));
+    if (inputs.back().size() != inputs[0].size())
+    {
+      throw std::runtime_error("Input files have different numbers of wires");
+    }
+    for (int i = 0; i < inputs[0].size(); i++)
+    {
+      if (inputs.back()[i].party_index != inputs[0][i].party_index)
+      {
+        throw std::runtime_error("Input files disagree on the owner of wire " + std::to_string(i));
+      }
+    }
+  }
+  int num_instances = inputs.size();
 
-  std::vector<InitialWireInput> input = parse_input(input_file);
+  // Every AND of every instance takes one random OT and one Beaver triple,
+  // and both are counted in an int. -1 if a streamed file does not say.
+  int num_ands = -1;
+  if (num_and_gate >= 0)
+  {
+    if (num_instances > 0 && num_and_gate > INT_MAX / num_instances)
+    {
+      throw std::runtime_error(std::to_string(num_and_gate) + " AND gates over " +
+                               std::to_string(num_instances) + " instances need more than " +
+                               std::to_string(INT_MAX) + " OTs");
+    }
+    num_ands = num_and_gate * num_instances;
+  }
   std::vector<std::string> addrs = parse_addrs(addr_file);
   int num_parties = addrs.size();
   int my_port = std::stoi(string_split(addrs[my_party], ':')[1]);
+  std::vector<std::vector<int>> received_outputs =
+      parse_output_parties(output_parties_spec, output_groups, num_parties);
 
   // ===============================
   // PREPARE TO CONNECT TO PEERS
   // ===============================
   std::shared_ptr<NetworkDriverImpl> network_driver = std::make_shared<NetworkDriverImpl>();
   std::shared_ptr<CryptoDriver> crypto_driver = std::make_shared<CryptoDriver>();
+  PhaseMetrics metrics;
 
   // ==========================
   // ESTABLISH SOCKETS
   // ==========================
+  metrics.start("connection setup", {});
 
   // Map from party index to their socket
   std::unordered_map<int, std::shared_ptr<boost::asio::ip::tcp::socket>> sockets;
@@ -83,11 +662,14 @@ int main(int argc, char *argv[])
     auto pl = PeerLink(socket, network_driver, crypto_driver);
     peer_links.emplace(other_party, pl);
   }
+  metrics.stop(link_metrics(peer_links));
 
   // ==============================
   // KEY EXCHANGE
   // ==============================
 
+  metrics.start("key exchange", link_metrics(peer_links));
+
   // Same trick. my_party number of listens, followed by the rest being sends
   for (int i = 0; i < my_party; i++)
   {
@@ -101,218 +683,207 @@ int main(int argc, char *argv[])
 
     pl.SendFirstHandleKeyExchange();
   }
+  metrics.stop(link_metrics(peer_links));
+
+  // ==============================
+  // OT EXTENSION SETUP
+  // ==============================
+
+  // The lower-indexed party of each pair is the OT sender during evaluation.
+  // The base OTs with every peer run concurrently.
+  metrics.start("OT extension setup", link_metrics(peer_links));
+  run_with_each_peer(peer_links, [&](int i, PeerLink &pl)
+                     { pl.SetupOTExtension(my_party < i); });
+  metrics.stop(link_metrics(peer_links));
+
+  // ==============================
+  // OFFLINE: RANDOM OTS
+  // ==============================
+
+  // Random 1-out-of-4 OTs for every AND of every instance, made before the
+  // inputs are known. The OTs that build the triples then only exchange a few
+  // bits each. A streamed Bristol file does not say how many it needs, so it
+  // starts with a fixed pool, and the OTs top it up as they go.
+  int num_random_ots = num_ands >= 0 ? num_ands : STREAM_RANDOM_OTS;
+  metrics.start("random OTs", link_metrics(peer_links));
+  run_with_each_peer(peer_links, [&](int i, PeerLink &pl)
+                     { pl.PrecomputeOTs(num_random_ots); });
+  metrics.stop(link_metrics(peer_links));
 
   // ===========================
   // SECRET SHARES
   // ===========================
   ShareDriver sd(my_party, num_parties);
-  std::vector<int> shares(circuit.num_wire, 0);
+  // Compiled and optimized circuits use recycled share slots as wires, so
+  // this is the circuit's width rather than its total wire count.
+  WireShares shares(num_wire, num_instances);
+
+  // ==============================
+  // OFFLINE: BEAVER TRIPLES
+  // ==============================
+
+  // All OTs happen here, before the inputs are used, so the online phase only
+  // opens masked bits. A streamed Bristol file does not say how many ANDs it
+  // has, so its triples are generated during evaluation instead.
+  std::vector<BeaverTriple> triples;
+  if (num_ands >= 0)
+  {
+    int num_triples = num_ands;
+    std::cout << "Generating " << num_triples << " Beaver triples" << std::endl;
+    metrics.start("Beaver triples", link_metrics(peer_links));
+    triples = generate_triples(peer_links, sd, my_party, num_triples);
+    metrics.stop(link_metrics(peer_links));
+  }
+  int next_triple = 0;
 
   // ========================
   // Initial wire sharing
   // ========================
-  for (int i = 0; i < input.size(); i++)
+  // Input shares come from the PRGs each pair of parties seeded during key
+  // exchange. For a wire owned by party o, every other party j takes the next
+  // bit of the o-j stream as its share, and o XORs those bits into its input
+  // to get its own share. Every party walks the wires in the same order, so
+  // the streams stay in step and no shares are sent.
+  metrics.start("input sharing", link_metrics(peer_links));
+  int num_inputs = inputs[0].size();
+  std::unordered_map<int, std::vector<int>> prss_bits;
+  std::unordered_map<int, int> next_prss_bit;
+  for (auto &[j, pl] : peer_links)
   {
-    InitialWireInput wire_initial_input = input[i];
-
-    int wire_owner = wire_initial_input.party_index;
-    int wire_value = wire_initial_input.value;
+    int count = 0;
+    for (int i = 0; i < num_inputs; i++)
+    {
+      int wire_owner = inputs[0][i].party_index;
+      if (wire_owner == my_party || wire_owner == j)
+      {
+        count += num_instances;
+      }
+    }
+    prss_bits[j] = pl.InputSharingBits(count);
+    next_prss_bit[j] = 0;
+  }
 
-    if (wire_owner == my_party)
+  for (int i = 0; i < num_inputs; i++)
+  {
+    int wire_owner = inputs[0][i].party_index;
+    if (wire_owner != my_party && !peer_links.count(wire_owner))
     {
-      std::cout << "OWNER: wire " << i << std::endl;
+      throw std::runtime_error("Input wire " + std::to_string(i) + " has no owner");
+    }
 
-      std::vector<int> wire_shares = sd.generate_shares(wire_initial_input.value);
-      for (int j = 0; j < num_parties; j++)
+    for (int t = 0; t < num_instances; t++)
+    {
+      if (wire_owner == my_party)
       {
-        int curr_share = wire_shares[j];
-
-        if (j == my_party)
-        {
-          shares[i] = curr_share;
-          std::cout << "Our share " << curr_share << std::endl;
-        }
-        else
+        int share = inputs[t][i].value;
+        for (auto &[j, bits] : prss_bits)
         {
-          std::cout << "Sending secret share of " << curr_share << " to party " << j << std::endl;
-          auto &pl = peer_links.at(j);
-          pl.SendSecretShare(curr_share);
+          share ^= bits[next_prss_bit[j]++];
         }
+        shares.set(i, t, share);
+      }
+      else
+      {
+        shares.set(i, t, prss_bits[wire_owner][next_prss_bit[wire_owner]++]);
       }
-    }
-    else
-    {
-      auto &pl = peer_links.at(wire_owner);
-      auto my_share = pl.ReceiveSecretShare();
-
-      std::cout << "Received secret share " << my_share << " for wire " << i << " from party " << wire_owner << std::endl;
-      shares[i] = my_share;
     }
   }
+  metrics.stop(link_metrics(peer_links));
 
   // =====================
   // GMW Circuit evaluation
   // ======================
-  for (Gate g : circuit.gates)
+  if (gate_stream)
   {
-    int left = shares[g.lhs];
-    int right = shares[g.rhs];
+    evaluate_stream(*gate_stream, shares, peer_links, sd, my_party, triples, next_triple, metrics);
+  }
+  else
+  {
+    evaluate_layers(*compiled, shares, peer_links, sd, my_party, triples, next_triple, metrics);
+  }
 
-    if (g.type == GateType::XOR_GATE)
-    {
-      shares[g.output] = (left ^ right);
-    }
-    else if (g.type == GateType::AND_GATE)
+  // ==================================
+  // OUTPUT RECONSTRUCTION
+  // ==================================
+  // Every party sends each receiver its shares of that receiver's outputs, all
+  // instances in one packed message, and only receivers wait for messages.
+  // Output k is in wire num_wire - output_length + k.
+  metrics.start("output reconstruction", link_metrics(peer_links));
+  auto output_shares_for = [&](int j)
+  {
+    std::vector<int> bits;
+    bits.reserve(received_outputs[j].size() * num_instances);
+    for (int t = 0; t < num_instances; t++)
     {
-      int ot_accumulator = 0;
-
-      for (int i = 0; i < num_parties; i++)
+      for (int k : received_outputs[j])
       {
-        if (my_party == i)
-        {
-          continue;
-        }
-        auto &pl = peer_links.at(i);
-
-        int ot_response;
-        if (my_party < i)
-        {
-          int bit = generate_bit();
-          ot_response = bit;
-
-          std::cout << "Random bit " << ot_response;
-          std::cout << "Sending options" << std::to_string(bit) << " " << std::to_string(bit ^ right) << " " << std::to_string(bit ^ left) << " " << std::to_string(bit ^ left ^ right) << std::endl;
-          std::vector<int> choices = {bit, bit ^ right, bit ^ left, bit ^ left ^ right};
-
-          // shares[g.output] =
-
-          // std::vector<int> choices = {bit, bit ^ left, bit ^ right, bit ^ left ^ right};
-
-          pl.OT_send(choices);
-        }
-        else
-        {
-          // // 0, 0 -> 0
-          // // 1, 0 -> 1
-          // // 0, 1 -> 2
-          // // 1, 1 -> 3
-          // int choice_bit = left + (2 * right);
-          // ot_response = pl.OT_recv(choice_bit);
-          int choice_bit;
-          if (left == 0)
-          {
-            if (right == 0)
-            {
-              choice_bit = 0;
-            }
-            else
-            {
-              choice_bit = 2;
-            }
-          }
-          else
-          {
-            if (right == 0)
-            {
-              choice_bit = 1;
-            }
-            else
-            {
-              choice_bit = 3;
-            }
-          }
-
-          ot_response = pl.OT_recv(choice_bit);
-
-          std::cout << "Received bit " << ot_response << " of choice " << choice_bit << std::endl;
-        }
-
-        ot_accumulator += ot_response;
+        bits.push_back(shares.get(num_wire - output_length + k, t));
       }
+    }
+    return bits;
+  };
 
-      ot_accumulator += (left * right);
-      ot_accumulator = ot_accumulator % 2;
-
-      std::cout << "Acc " << ot_accumulator << std::endl;
-
-      shares[g.output] = ot_accumulator;
+  std::vector<int> my_outputs = output_shares_for(my_party);
+  auto all_shares = run_with_each_peer(peer_links, [&](int j, PeerLink &pl)
+                                       {
+    if (!received_outputs[j].empty())
+    {
+      pl.SendOutputShares(output_shares_for(j));
     }
-    else if (g.type == GateType::NOT_GATE)
+    if (my_outputs.empty())
     {
-      if (my_party == 0)
-      {
-        shares[g.output] = 1 - left;
-      }
-      else
-      {
-        shares[g.output] = left;
-      }
+      return std::vector<int>();
     }
-    else
+    std::vector<int> their_shares = pl.ReceiveOutputShares();
+    if (their_shares.size() != my_outputs.size())
     {
-      throw std::runtime_error("Invalid gate type found");
+      throw std::runtime_error("Received wrong number of output shares");
     }
+    return their_shares; });
+  metrics.stop(link_metrics(peer_links));
+  if (!metrics_file.empty())
+  {
+    metrics.write_json(metrics_file, my_party);
   }
 
-  // ==================================
-  // OUTPUT GATHERING FROM SHARES
-  // ==================================
-  std::string output_share = "";
-  std::cout << "OUTPUT SHARES" << std::endl;
-  for (int i = circuit.output_length; i > 0; i--)
+  if (my_outputs.empty())
   {
-    auto curr_share = shares.at(circuit.num_wire - i);
-    std::cout << curr_share << " from " << circuit.num_gate - i - 1 << std::endl;
-    output_share += std::to_string(curr_share);
+    std::cout << "Party " << my_party << " receives no outputs" << std::endl;
+    return 0;
   }
-
-  std::cout << "Self output share is " << output_share << std::endl;
-
-  std::vector<std::string> all_shares;
-  for (int i = 0; i < num_parties; i++)
+  for (auto &their_shares : all_shares)
   {
-    if (i == my_party)
+    for (int k = 0; k < my_outputs.size(); k++)
     {
-      all_shares.push_back(output_share);
-      continue;
+      my_outputs[k] ^= their_shares[k];
     }
-
-    auto &pl = peer_links.at(i);
-    pl.GossipSend(output_share);
   }
 
-  for (int i = 0; i < num_parties; i++)
+  // Outputs this party does not receive print as '-'.
+  std::string final_output(num_instances * output_length, '-');
+  int num_received = received_outputs[my_party].size();
+  for (int t = 0; t < num_instances; t++)
   {
-    if (i == my_party)
+    for (int n = 0; n < num_received; n++)
     {
-      continue;
+      final_output[t * output_length + received_outputs[my_party][n]] =
+          '0' + my_outputs[t * num_received + n];
     }
-
-    auto &pl = peer_links.at(i);
-    all_shares.push_back(pl.GossipReceive());
   }
 
-  // =========================
-  // FINAL XORing
-  // =========================
-
-  std::string final_output = "";
-  for (int i = 0; i < output_share.size(); i++)
+  if (num_instances == 1)
   {
-    int curr_bit = 0;
-    for (int j = 0; j < all_shares.size(); j++)
+    std::cout << "Final output is " << final_output << std::endl;
+  }
+  else
+  {
+    for (int t = 0; t < num_instances; t++)
     {
-      std::cout << "Sanity check: " << int(all_shares[j][i] - '0') << std::endl;
-      curr_bit ^= int(all_shares[j][i] - '0');
+      std::cout << "Final output of instance " << t << " is "
+                << final_output.substr(t * output_length, output_length) << std::endl;
     }
-
-    char x = static_cast<char>(curr_bit + '0');
-    std::cout << "Final sanity check " << x << std::endl;
-    final_output.push_back(x);
   }
 
-  std::cout << "Final output is " << final_output << std::endl;
-
   return 0;
 }
 
@@ -1,10 +1,10 @@
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 #include <string>
 
 #include "crypto++/base64.h"
 #include "crypto++/dsa.h"
-#include "crypto++/osrng.h"
 #include "crypto++/rsa.h"
 #include <crypto++/cryptlib.h>
 #include <crypto++/elgamal.h>
@@ -13,75 +13,247 @@
 #include <crypto++/queue.h>
 
 #include "../../include-shared/constants.hpp"
+#include "../../include-shared/prg.hpp"
 #include "../../include-shared/util.hpp"
 #include "../../include/drivers/crypto_driver.hpp"
 
 using namespace CryptoPP;
 
+namespace {
 /**
- * @brief Encrypts the given message using AES and tags the ciphertext with an
- * HMAC. Outputs an HMACTagged_Wrapper as bytes.
+ * @brief Builds the implicit nonce channel || counter, both big-endian.
  */
-std::vector<unsigned char>
-CryptoDriver::encrypt_and_tag(SecByteBlock AES_key, SecByteBlock HMAC_key,
-                              Serializable *message) {
-  // Serialize given message.
-  std::vector<unsigned char> plaintext;
-  message->serialize(plaintext);
+void make_nonce(int channel, uint64_t counter, unsigned char *nonce) {
+  uint32_t c = channel;
+  for (int i = 0; i < 4; i++) {
+    nonce[i] = (c >> (24 - 8 * i)) & 0xff;
+  }
+  for (int i = 0; i < 8; i++) {
+    nonce[4 + i] = (counter >> (56 - 8 * i)) & 0xff;
+  }
+}
+
+/**
+ * @brief Derives an AES key from a DH shared key. The info string names what
+ * the key is for, so each use gets an independent key.
+ */
+SecByteBlock derive_key(const SecByteBlock &DH_shared_key, std::string info) {
+  std::string salt_str("salt0002");
+  SecByteBlock salt((const unsigned char *)(salt_str.data()), salt_str.size());
+  SecByteBlock key(AES::DEFAULT_KEYLENGTH);
+  HKDF<SHA256> hkdf;
+  hkdf.DeriveKey(key, key.size(), DH_shared_key, DH_shared_key.size(), salt,
+                 salt.size(), (const unsigned char *)info.data(), info.size());
+  return key;
+}
+
+/**
+ * @brief Returns this thread's copy of the DH group. The group and its table
+ * of fixed-base powers are built once; each thread then copies them, because
+ * Crypto++ group operations write to scratch space inside the group object.
+ */
+const DH &local_DH_group() {
+  static const DH prototype = [] {
+    DH group(DL_P, DL_Q, DL_G);
+    group.AccessGroupParameters().Precompute();
+    return group;
+  }();
+  thread_local const DH group = prototype;
+  return group;
+}
+} // namespace
+
+CryptoTimer::CryptoTimer(AEADSession &session)
+    : session(session), start(std::chrono::steady_clock::now()),
+      running(true) {}
+
+CryptoTimer::~CryptoTimer() { pause(); }
+
+void CryptoTimer::pause() {
+  if (running) {
+    session.crypto_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    running = false;
+  }
+}
 
-  // Encrypt the payload, generate iv to hmac.
-  std::pair<std::string, SecByteBlock> encrypted =
-      this->AES_encrypt(AES_key, chvec2str(plaintext));
-  std::string to_tag = std::string((const char *)encrypted.second.data(),
-                                   encrypted.second.size()) +
-                       encrypted.first;
+void CryptoTimer::resume() {
+  if (!running) {
+    start = std::chrono::steady_clock::now();
+    running = true;
+  }
+}
+
+/**
+ * @brief Starts filling the keypair pool in the background.
+ */
+CryptoDriver::CryptoDriver() {
+  this->keypair_thread = std::thread(&CryptoDriver::fill_keypair_pool, this);
+}
 
-  // Generate HMAC on the payload.
-  HMACTagged_Wrapper msg;
-  msg.payload = str2chvec(encrypted.first);
-  msg.iv = encrypted.second;
-  msg.mac = this->HMAC_generate(HMAC_key, to_tag);
+CryptoDriver::~CryptoDriver() {
+  {
+    std::lock_guard<std::mutex> lock(this->keypair_mutex);
+    this->stopping = true;
+  }
+  this->keypair_taken.notify_all();
+  this->keypair_thread.join();
+}
+
+/**
+ * @brief Sets up an AES-GCM session from a DH shared key. The party that sent
+ * its public value first encrypts with one derived key and the other party
+ * with the other, so the two directions never share a (key, nonce) pair.
+ */
+std::shared_ptr<AEADSession>
+CryptoDriver::AEAD_session_initialize(const SecByteBlock &DH_shared_key,
+                                      bool send_first) {
+  SecByteBlock first_key = derive_key(DH_shared_key, "send-first");
+  SecByteBlock second_key = derive_key(DH_shared_key, "read-first");
+  SecByteBlock &send_key = send_first ? first_key : second_key;
+  SecByteBlock &recv_key = send_first ? second_key : first_key;
+
+  unsigned char nonce[AEAD_NONCE_SIZE] = {0};
+  auto session = std::make_shared<AEADSession>();
+  session->encryptor.SetKeyWithIV(send_key, send_key.size(), nonce,
+                                  AEAD_NONCE_SIZE);
+  session->decryptor.SetKeyWithIV(recv_key, recv_key.size(), nonce,
+                                  AEAD_NONCE_SIZE);
+  return session;
+}
+
+/**
+ * @brief Sets up the PRG a pair of parties uses to share inputs without
+ * messages. Unlike the session keys, both parties derive the same key, so
+ * their PRGs produce the same stream.
+ */
+std::shared_ptr<PRG>
+CryptoDriver::PRSS_initialize(const SecByteBlock &DH_shared_key) {
+  return std::make_shared<PRG>(derive_key(DH_shared_key, "input-sharing"));
+}
+
+/**
+ * @brief Serializes the message and encrypts it in place with AES-GCM under
+ * the next nonce of the given channel. Outputs ciphertext || tag.
+ */
+std::vector<unsigned char>
+CryptoDriver::encrypt_and_tag(AEADSession &session, int channel,
+                              Serializable *message) {
+  CryptoTimer timer(session);
+  std::vector<unsigned char> data;
+  message->serialize(data);
+  size_t length = data.size();
+  data.resize(length + AEAD_TAG_SIZE);
 
-  // Serialize the HMAC and payload.
-  std::vector<unsigned char> payload_data;
-  msg.serialize(payload_data);
-  return payload_data;
+  std::lock_guard<std::mutex> lock(session.send_mutex);
+  unsigned char nonce[AEAD_NONCE_SIZE];
+  make_nonce(channel, session.send_counters[channel]++, nonce);
+  session.encryptor.EncryptAndAuthenticate(
+      data.data(), data.data() + length, AEAD_TAG_SIZE, nonce, AEAD_NONCE_SIZE,
+      NULL, 0, data.data(), length);
+  return data;
 }
 
 /**
- * @brief Verifies that the tagged HMAC is valid on the ciphertext and decrypts
- * the given message using AES. Takes in an HMACTagged_Wrapper as bytes.
+ * @brief Decrypts and verifies ciphertext || tag in place under the next nonce
+ * of the given channel. On a bad tag, returns an empty plaintext and leaves
+ * the channel counter where it was.
  */
 std::pair<std::vector<unsigned char>, bool>
-CryptoDriver::decrypt_and_verify(SecByteBlock AES_key, SecByteBlock HMAC_key,
+CryptoDriver::decrypt_and_verify(AEADSession &session, int channel,
                                  std::vector<unsigned char> ciphertext_data) {
-  // Deserialize
-  HMACTagged_Wrapper ciphertext;
-  ciphertext.deserialize(ciphertext_data);
+  CryptoTimer timer(session);
+  if (ciphertext_data.size() < AEAD_TAG_SIZE) {
+    return std::make_pair(std::vector<unsigned char>(), false);
+  }
+  size_t length = ciphertext_data.size() - AEAD_TAG_SIZE;
 
-  // Verify HMAC
-  std::string to_verify =
-      std::string((const char *)ciphertext.iv.data(), ciphertext.iv.size()) +
-      chvec2str(ciphertext.payload);
-  bool valid = this->HMAC_verify(HMAC_key, to_verify, ciphertext.mac);
+  std::lock_guard<std::mutex> lock(session.recv_mutex);
+  unsigned char nonce[AEAD_NONCE_SIZE];
+  make_nonce(channel, session.recv_counters[channel], nonce);
+  bool valid = session.decryptor.DecryptAndVerify(
+      ciphertext_data.data(), ciphertext_data.data() + length, AEAD_TAG_SIZE,
+      nonce, AEAD_NONCE_SIZE, NULL, 0, ciphertext_data.data(), length);
+  if (!valid) {
+    return std::make_pair(std::vector<unsigned char>(), false);
+  }
+  session.recv_counters[channel]++;
+  ciphertext_data.resize(length);
+  return std::make_pair(std::move(ciphertext_data), true);
+}
 
-  // Decrypt
-  std::string plaintext =
-      this->AES_decrypt(AES_key, ciphertext.iv, chvec2str(ciphertext.payload));
-  std::vector<unsigned char> plaintext_data = str2chvec(plaintext);
-  return std::make_pair(plaintext_data, valid);
+/**
+ * @brief Generate DH keypair. The group is the calling thread's cached copy,
+ * and the keypair comes from the pool unless it has run dry.
+ */
+std::tuple<const DH &, SecByteBlock, SecByteBlock>
+CryptoDriver::DH_initialize() {
+  std::pair<SecByteBlock, SecByteBlock> keypair;
+  {
+    std::lock_guard<std::mutex> lock(this->keypair_mutex);
+    if (!this->keypair_pool.empty()) {
+      keypair = std::move(this->keypair_pool.front());
+      this->keypair_pool.pop_front();
+    }
+  }
+  this->keypair_taken.notify_one();
+  if (keypair.first.size() == 0) {
+    keypair = DH_generate_keypair();
+  }
+  return std::tuple<const DH &, SecByteBlock, SecByteBlock>(
+      local_DH_group(), keypair.first, keypair.second);
 }
 
 /**
- * @brief Generate DH keypair.
+ * @brief Returns this thread's copy of the P-256 group used for base OT, with
+ * compressed points and a table of fixed-base powers. Built and copied like
+ * the DH group.
  */
-std::tuple<DH, SecByteBlock, SecByteBlock> CryptoDriver::DH_initialize() {
-  DH DH_obj(DL_P, DL_Q, DL_G);
-  AutoSeededRandomPool prng;
-  SecByteBlock DH_private_key(DH_obj.PrivateKeyLength());
-  SecByteBlock DH_public_key(DH_obj.PublicKeyLength());
-  DH_obj.GenerateKeyPair(prng, DH_private_key, DH_public_key);
-  return std::make_tuple(DH_obj, DH_private_key, DH_public_key);
+const DL_GroupParameters_EC<ECP> &CryptoDriver::EC_group() {
+  static const DL_GroupParameters_EC<ECP> prototype = [] {
+    DL_GroupParameters_EC<ECP> group(ASN1::secp256r1());
+    group.SetPointCompression(true);
+    group.Precompute();
+    return group;
+  }();
+  thread_local const DL_GroupParameters_EC<ECP> group = prototype;
+  return group;
+}
+
+/**
+ * @brief Generates one keypair in the cached group. Raising the generator to
+ * the private key uses the precomputed table.
+ */
+std::pair<SecByteBlock, SecByteBlock> CryptoDriver::DH_generate_keypair() {
+  PRG &prng = PRG::local();
+  const DH &group = local_DH_group();
+  SecByteBlock DH_private_key(group.PrivateKeyLength());
+  SecByteBlock DH_public_key(group.PublicKeyLength());
+  group.GenerateKeyPair(prng, DH_private_key, DH_public_key);
+  return std::make_pair(DH_private_key, DH_public_key);
+}
+
+/**
+ * @brief Background thread. Refills the keypair pool to DH_KEYPAIR_POOL_SIZE
+ * whenever keypairs are taken, until the driver is destroyed.
+ */
+void CryptoDriver::fill_keypair_pool() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(this->keypair_mutex);
+      this->keypair_taken.wait(lock, [&] {
+        return this->stopping ||
+               this->keypair_pool.size() < DH_KEYPAIR_POOL_SIZE;
+      });
+      if (this->stopping) {
+        return;
+      }
+    }
+    auto keypair = DH_generate_keypair();
+    std::lock_guard<std::mutex> lock(this->keypair_mutex);
+    this->keypair_pool.push_back(std::move(keypair));
+  }
 }
 
 /**
@@ -130,8 +302,7 @@ CryptoDriver::AES_encrypt(SecByteBlock key, std::string plaintext) {
     CBC_Mode<AES>::Encryption AES_encryptor = CBC_Mode<AES>::Encryption();
 
     SecByteBlock iv(AES::BLOCKSIZE);
-    AutoSeededRandomPool rng;
-    AES_encryptor.GetNextIV(rng, iv.BytePtr());
+    AES_encryptor.GetNextIV(PRG::local(), iv.BytePtr());
     AES_encryptor.SetKeyWithIV(key, key.size(), iv);
 
     // Encrypt using a StreamTransformationFilter
@@ -172,57 +343,6 @@ std::string CryptoDriver::AES_decrypt(SecByteBlock key, SecByteBlock iv,
   }
 }
 
-/**
- * @brief Generates an HMAC key using HKDF with a salt.
- */
-SecByteBlock
-CryptoDriver::HMAC_generate_key(const SecByteBlock &DH_shared_key) {
-  std::string hmac_salt_str("salt0001");
-  SecByteBlock hmac_salt((const unsigned char *)(hmac_salt_str.data()),
-                         hmac_salt_str.size());
-  // Derive 256 byte ECB key from DH shared key using KDF
-  HKDF<SHA256> hkdf;
-  SecByteBlock HMAC_shared_key(SHA256::BLOCKSIZE);
-  hkdf.DeriveKey(HMAC_shared_key, HMAC_shared_key.size(), DH_shared_key,
-                 DH_shared_key.size(), hmac_salt, hmac_salt.size(), NULL, 0);
-  return HMAC_shared_key;
-}
-
-/**
- * @brief Given a ciphertext, generates an HMAC
- */
-std::string CryptoDriver::HMAC_generate(SecByteBlock key,
-                                        std::string ciphertext) {
-  try {
-    std::string mac;
-    HMAC<SHA256> hmac(key, key.size());
-    StringSource ss2(ciphertext, true,
-                     new HashFilter(hmac, new StringSink(mac)));
-    return mac;
-  } catch (const CryptoPP::Exception &e) {
-    std::cerr << e.what() << std::endl;
-    throw std::runtime_error("CryptoDriver HMAC generation failed.");
-  }
-}
-
-/**
- * @brief Given a message and MAC, checks the MAC is valid.
- */
-bool CryptoDriver::HMAC_verify(SecByteBlock key, std::string ciphertext,
-                               std::string mac) {
-  const int flags = HashVerificationFilter::THROW_EXCEPTION |
-                    HashVerificationFilter::HASH_AT_END;
-  try {
-    HMAC<SHA256> hmac(key, key.size());
-    StringSource(ciphertext + mac, true,
-                 new HashVerificationFilter(hmac, NULL, flags));
-    return true;
-  } catch (const CryptoPP::Exception &e) {
-    std::cerr << e.what() << std::endl;
-    return false;
-  }
-}
-
 /**
  * Hash inputs. SHA256(lhs || rhs)
  */
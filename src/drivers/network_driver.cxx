@@ -1,31 +1,90 @@
 #include "../../include/drivers/network_driver.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <stdexcept>
 #include <vector>
 
+#include "../../include-shared/constants.hpp"
+
 using namespace boost::asio;
 using ip::tcp;
 
 /**
- * Constructor. Sets up IO context and socket.
+ * Constructor. Sets up IO context and the thread that runs all asynchronous
+ * reads and writes.
  */
-NetworkDriverImpl::NetworkDriverImpl() : io_context() {}
+NetworkDriverImpl::NetworkDriverImpl()
+    : io_context(), work_guard(boost::asio::make_work_guard(io_context))
+{
+  io_thread = std::thread([this]()
+                          { io_context.run(); });
+}
 
-NetworkDriverImpl::~NetworkDriverImpl() { io_context.stop(); }
+/**
+ * Destructor. Gives queued frames up to NETWORK_CLOSE_TIMEOUT_MS to be
+ * written, then stops IO and closes every socket, so a dead peer cannot hold
+ * up shutdown.
+ */
+NetworkDriverImpl::~NetworkDriverImpl()
+{
+  std::vector<std::shared_ptr<NetworkConnection>> conns;
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    for (auto &[sock, conn] : connections)
+    {
+      conns.push_back(conn);
+    }
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(NETWORK_CLOSE_TIMEOUT_MS);
+  for (auto &conn : conns)
+  {
+    std::unique_lock<std::mutex> conn_lock(conn->mutex);
+    conn->changed.wait_until(conn_lock, deadline, [&]()
+                             { return !conn->writing; });
+  }
+
+  work_guard.reset();
+  io_context.stop();
+  io_thread.join();
+  for (auto &conn : conns)
+  {
+    boost::system::error_code ignored;
+    conn->socket->close(ignored);
+  }
+}
+
+/**
+ * Open the listening socket on the given port, or any free port for 0. Later
+ * listens accept on it.
+ *
+ * @param port Port to listen on.
+ * @return The port bound.
+ */
+int NetworkDriverImpl::bind(int port)
+{
+  this->acceptor = std::make_unique<tcp::acceptor>(this->io_context, tcp::endpoint(tcp::v4(), port));
+  return this->acceptor->local_endpoint().port();
+}
 
 /**
- * Listen on the given port at localhost.
+ * Listen on the given port at localhost, binding it first if bind has not.
  *
  * @param port Port to listen on.
  */
 std::shared_ptr<tcp::socket> NetworkDriverImpl::listen(int port)
 {
-  static tcp::acceptor acceptor(this->io_context, tcp::endpoint(tcp::v4(), port));
+  if (!this->acceptor)
+  {
+    bind(port);
+  }
   auto s = std::make_shared<tcp::socket>(io_context);
-  acceptor.accept(*s);
+  this->acceptor->accept(*s);
   std::string remote_info = s->remote_endpoint().address().to_string() + ":" +
                             std::to_string(s->remote_endpoint().port());
-  std::cout << "Party listening on port " << port << "got connection from " << remote_info << std::endl;
+  std::cerr << "Party listening on port " << port << " got connection from " << remote_info << std::endl;
+  add_connection(s);
   return s;
 }
 
@@ -44,11 +103,12 @@ std::shared_ptr<tcp::socket> NetworkDriverImpl::connect(int other_party, std::st
     try
     {
       s->connect(tcp::endpoint(boost::asio::ip::address::from_string(address), port));
+      add_connection(s);
       return s;
     }
     catch (boost::wrapexcept<boost::system::system_error> &e)
     {
-      std::cout << "Couldn't connect to party " << other_party << ". Retrying in 3 seconds." << std::endl;
+      std::cerr << "Couldn't connect to party " << other_party << ". Retrying in 3 seconds." << std::endl;
       std::this_thread::sleep_for(std::chrono::seconds(3));
     }
   }
@@ -65,41 +125,323 @@ void NetworkDriverImpl::disconnect(int other_party)
   throw std::runtime_error("not yet implemented!");
 }
 
-void NetworkDriverImpl::socket_send(std::shared_ptr<boost::asio::ip::tcp::socket> sock, std::vector<unsigned char> data)
+/**
+ * Start tracking a connected socket and reading frames from it.
+ */
+void NetworkDriverImpl::add_connection(std::shared_ptr<tcp::socket> sock)
+{
+  auto conn = std::make_shared<NetworkConnection>();
+  conn->socket = sock;
+  conn->read_buffer.resize(NETWORK_READ_BUFFER_SIZE);
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    connections[sock.get()] = conn;
+  }
+  boost::asio::post(io_context, [this, conn]()
+                    { read_frames(conn); });
+}
+
+std::shared_ptr<NetworkConnection> NetworkDriverImpl::get_connection(std::shared_ptr<tcp::socket> sock)
 {
-  int length = htonl(data.size());
-  boost::asio::write(*sock,
-                     boost::asio::buffer(&length, sizeof(int)));
-  boost::asio::write(*sock, boost::asio::buffer(data));
+  std::lock_guard<std::mutex> lock(connections_mutex);
+  auto it = connections.find(sock.get());
+  if (it == connections.end())
+  {
+    throw std::runtime_error("Socket was not opened by this network driver.");
+  }
+  return it->second;
+}
+
+/**
+ * Mark the connection as closed for reading with the reason and wake up any
+ * waiting readers.
+ */
+void NetworkDriverImpl::fail_read(std::shared_ptr<NetworkConnection> conn, const boost::system::error_code &error)
+{
+  {
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    if (conn->read_error.empty())
+    {
+      conn->read_error = error == boost::asio::error::eof
+                             ? "Received EOF."
+                             : "Failed to read from socket: " + error.message();
+    }
+  }
+  conn->changed.notify_all();
 }
 
 /**
- * Receives a fixed amount of data by receiving length first.
+ * Read as many bytes as are available into the receive buffer, queue every
+ * complete frame, then read again. Small frames therefore cost one read for
+ * the whole batch rather than two reads each. Runs on the IO thread.
+ */
+void NetworkDriverImpl::read_frames(std::shared_ptr<NetworkConnection> conn)
+{
+  // Move the partial frame left over from the last read to the front.
+  if (conn->read_begin > 0)
+  {
+    std::memmove(conn->read_buffer.data(), conn->read_buffer.data() + conn->read_begin,
+                 conn->read_end - conn->read_begin);
+    conn->read_end -= conn->read_begin;
+    conn->read_begin = 0;
+  }
+
+  conn->socket->async_read_some(
+      boost::asio::buffer(conn->read_buffer.data() + conn->read_end,
+                          conn->read_buffer.size() - conn->read_end),
+      [this, conn](const boost::system::error_code &error, size_t bytes_read)
+      {
+        if (error)
+        {
+          fail_read(conn, error);
+          return;
+        }
+        conn->read_end += bytes_read;
+        if (parse_frames(conn))
+        {
+          read_frames(conn);
+        }
+      });
+}
+
+/**
+ * Queue every complete frame (length, channel, payload) in the receive buffer.
+ * A frame that cannot fit in the buffer is instead read directly into its own
+ * payload, in which case this returns false and read_large_frame takes over.
+ */
+bool NetworkDriverImpl::parse_frames(std::shared_ptr<NetworkConnection> conn)
+{
+  const size_t header_size = 2 * sizeof(uint32_t);
+  std::vector<std::pair<int, std::vector<unsigned char>>> frames;
+  bool large = false;
+  size_t large_offset = 0;
+
+  while (conn->read_end - conn->read_begin >= header_size)
+  {
+    const unsigned char *frame = conn->read_buffer.data() + conn->read_begin;
+    uint32_t header[2];
+    std::memcpy(header, frame, header_size);
+    size_t length = ntohl(header[0]);
+    int channel = ntohl(header[1]);
+    size_t available = conn->read_end - conn->read_begin - header_size;
+
+    if (length > available)
+    {
+      if (header_size + length <= conn->read_buffer.size())
+      {
+        break;
+      }
+      conn->large_channel = channel;
+      conn->large_payload.resize(length);
+      std::memcpy(conn->large_payload.data(), frame + header_size, available);
+      conn->read_begin = conn->read_end = 0;
+      large = true;
+      large_offset = available;
+      break;
+    }
+
+    frames.emplace_back(channel, std::vector<unsigned char>(frame + header_size,
+                                                            frame + header_size + length));
+    conn->read_begin += header_size + length;
+  }
+
+  if (!frames.empty())
+  {
+    {
+      std::lock_guard<std::mutex> lock(conn->mutex);
+      for (auto &[channel, payload] : frames)
+      {
+        conn->inbox[channel].push_back(std::move(payload));
+      }
+    }
+    conn->changed.notify_all();
+  }
+  if (large)
+  {
+    read_large_frame(conn, large_offset);
+  }
+  return !large;
+}
+
+/**
+ * Finish reading a large frame into its payload, starting at offset, then go
+ * back to reading through the receive buffer. Runs on the IO thread.
+ */
+void NetworkDriverImpl::read_large_frame(std::shared_ptr<NetworkConnection> conn, size_t offset)
+{
+  boost::asio::async_read(
+      *conn->socket,
+      boost::asio::buffer(conn->large_payload.data() + offset,
+                          conn->large_payload.size() - offset),
+      [this, conn](const boost::system::error_code &error, size_t)
+      {
+        if (error)
+        {
+          fail_read(conn, error);
+          return;
+        }
+        {
+          std::lock_guard<std::mutex> lock(conn->mutex);
+          conn->inbox[conn->large_channel].push_back(std::move(conn->large_payload));
+        }
+        conn->large_payload = std::vector<unsigned char>();
+        conn->changed.notify_all();
+        read_frames(conn);
+      });
+}
+
+/**
+ * Write every queued frame (up to NETWORK_MAX_WRITE_BATCH) with one gathered
+ * write, then repeat until the outbox is empty. Runs on the IO thread.
+ */
+void NetworkDriverImpl::write_frames(std::shared_ptr<NetworkConnection> conn)
+{
+  // Frames stay in the outbox until written. Appending to a deque does not
+  // move existing elements, so the buffers stay valid while sends continue.
+  std::vector<boost::asio::const_buffer> buffers;
+  size_t count;
+  {
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    count = std::min<size_t>(conn->outbox.size(), NETWORK_MAX_WRITE_BATCH);
+    buffers.reserve(2 * count);
+    for (size_t i = 0; i < count; i++)
+    {
+      OutgoingFrame &frame = conn->outbox[i];
+      buffers.push_back(boost::asio::buffer(frame.header, sizeof(frame.header)));
+      if (!frame.payload.empty())
+      {
+        buffers.push_back(boost::asio::buffer(frame.payload));
+      }
+    }
+  }
+
+  boost::asio::async_write(
+      *conn->socket, buffers,
+      [this, conn, count](const boost::system::error_code &error, size_t)
+      {
+        bool more;
+        {
+          std::lock_guard<std::mutex> lock(conn->mutex);
+          if (error)
+          {
+            conn->write_error = "Failed to write to socket: " + error.message();
+            conn->outbox.clear();
+          }
+          else
+          {
+            for (size_t i = 0; i < count; i++)
+            {
+              conn->outbox.pop_front();
+            }
+          }
+          more = !conn->outbox.empty();
+          conn->writing = more;
+        }
+        if (more)
+        {
+          write_frames(conn);
+        }
+        else
+        {
+          conn->changed.notify_all();
+        }
+      });
+}
+
+/**
+ * Queues data to be sent on the given channel and returns without waiting for
+ * it to be written. The data is moved into the queue, not copied, so callers
+ * should pass it with std::move. Frames are written in the order they are
+ * queued.
+ * @throws error if an earlier write failed.
+ */
+void NetworkDriverImpl::socket_send(std::shared_ptr<boost::asio::ip::tcp::socket> sock, std::vector<unsigned char> data, int channel)
+{
+  auto conn = get_connection(sock);
+
+  std::lock_guard<std::mutex> lock(conn->mutex);
+  if (!conn->write_error.empty())
+  {
+    throw std::runtime_error(conn->write_error);
+  }
+  // frame = length || channel || data
+  OutgoingFrame &frame = conn->outbox.emplace_back();
+  frame.header[0] = htonl(data.size());
+  frame.header[1] = htonl(channel);
+  frame.payload = std::move(data);
+  conn->metrics.bytes_sent += sizeof(frame.header) + frame.payload.size();
+  conn->metrics.messages_sent++;
+  if (!conn->writing)
+  {
+    conn->writing = true;
+    boost::asio::post(io_context, [this, conn]()
+                      { write_frames(conn); });
+  }
+}
+
+/**
+ * Receives the next message sent on the given channel, waiting until one
+ * arrives. Messages on other channels stay queued for their own readers.
  * @return std::vector<unsigned char> data read.
  * @throws error when eof.
  */
-std::vector<unsigned char> NetworkDriverImpl::socket_read(std::shared_ptr<boost::asio::ip::tcp::socket> sock)
+std::vector<unsigned char> NetworkDriverImpl::socket_read(std::shared_ptr<boost::asio::ip::tcp::socket> sock, int channel)
 {
-  // read length
-  int length;
-  boost::system::error_code error;
-  boost::asio::read(*sock,
-                    boost::asio::buffer(&length, sizeof(int)),
-                    boost::asio::transfer_exactly(sizeof(int)), error);
-  if (error)
+  auto conn = get_connection(sock);
+
+  std::unique_lock<std::mutex> lock(conn->mutex);
+  auto &queue = conn->inbox[channel];
+  auto start = std::chrono::steady_clock::now();
+  conn->changed.wait(lock, [&]()
+                     { return !queue.empty() || !conn->read_error.empty(); });
+  conn->metrics.wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+  if (queue.empty())
   {
-    throw std::runtime_error("Received EOF.");
+    throw std::runtime_error(conn->read_error);
   }
-  length = ntohl(length);
 
-  // read message
-  std::vector<unsigned char> data;
-  data.resize(length);
-  boost::asio::read(*sock, boost::asio::buffer(data),
-                    boost::asio::transfer_exactly(length), error);
-  if (error)
+  std::vector<unsigned char> data = std::move(queue.front());
+  queue.pop_front();
+  conn->metrics.bytes_received += 2 * sizeof(uint32_t) + data.size();
+  conn->metrics.messages_received++;
+  return data;
+}
+
+/**
+ * Closes a socket. Readers waiting on it fail instead of blocking, later
+ * sends throw, and the other side sees the connection drop.
+ */
+void NetworkDriverImpl::socket_close(std::shared_ptr<boost::asio::ip::tcp::socket> sock)
+{
+  auto conn = get_connection(sock);
   {
-    throw std::runtime_error("Received EOF.");
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    if (conn->read_error.empty())
+    {
+      conn->read_error = "Connection closed.";
+    }
+    if (conn->write_error.empty())
+    {
+      conn->write_error = "Connection closed.";
+    }
   }
-  return data;
-}
\ No newline at end of file
+  conn->changed.notify_all();
+  boost::asio::post(io_context, [conn]()
+                    {
+    boost::system::error_code ignored;
+    conn->socket->shutdown(tcp::socket::shutdown_both, ignored);
+    conn->socket->close(ignored); });
+}
+
+/**
+ * Returns the traffic counters of a socket so far.
+ */
+LinkMetrics NetworkDriverImpl::socket_metrics(std::shared_ptr<boost::asio::ip::tcp::socket> sock)
+{
+  auto conn = get_connection(sock);
+
+  std::lock_guard<std::mutex> lock(conn->mutex);
+  return conn->metrics;
+}
@@ -4,157 +4,992 @@
 #include <crypto++/elgamal.h>
 #include <crypto++/files.h>
 #include <crypto++/hkdf.h>
+#include <crypto++/modarith.h>
 #include <crypto++/nbtheory.h>
 #include <crypto++/queue.h>
 #include <crypto++/sha.h>
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 #include <string>
 
 #include "../../include-shared/constants.hpp"
 #include "../../include-shared/messages.hpp"
+#include "../../include-shared/prg.hpp"
 #include "../../include-shared/util.hpp"
 #include "crypto++/base64.h"
 #include "crypto++/dsa.h"
-#include "crypto++/osrng.h"
 #include "crypto++/rsa.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 auto &mod_exp = CryptoPP::ModularExponentiation;
 
+namespace
+{
+  /*
+   * Get bit i of a packed bit string. Bit i lives in byte i / 8 at position
+   * i % 8.
+   */
+  int get_packed_bit(const unsigned char *bits, size_t i)
+  {
+    return (bits[i / 8] >> (i % 8)) & 1;
+  }
+
+  /*
+   * Set bit i of a packed bit string, which must be zero beforehand.
+   */
+  void set_packed_bit(unsigned char *bits, size_t i, int bit)
+  {
+    bits[i / 8] |= (bit & 1) << (i % 8);
+  }
+
+  /*
+   * Bit i of the codeword of choice c in [0, 4) for 1-out-of-4 OT extension.
+   * The code repeats (c_0, c_1, c_0 XOR c_1): any two of its 2-bit messages
+   * differ in two of every three positions, so distinct codewords differ in
+   * 2/3 of the OT_EXTENSION_WIDTH bits, which is 128.
+   */
+  int code_bit(int c, int i)
+  {
+    switch (i % 3)
+    {
+    case 0:
+      return c & 1;
+    case 1:
+      return (c >> 1) & 1;
+    default:
+      return (c ^ (c >> 1)) & 1;
+    }
+  }
+
+#ifndef __SSE2__
+  /*
+   * Transpose the 8x8 bit matrix whose row k is byte k of x, so that bit j of
+   * byte k becomes bit k of byte j.
+   */
+  uint64_t transpose_8x8(uint64_t x)
+  {
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x ^= t ^ (t << 28);
+    return x;
+  }
+#endif
+
+  /*
+   * Transpose the OT_EXTENSION_WIDTH x num_ots bit matrix stored column by
+   * column (num_bytes bytes per column) into num_ots rows of
+   * OT_EXTENSION_WIDTH bits each. The bits are secret, so this works on whole
+   * blocks of bits and only branches on the dimensions.
+   */
+  std::vector<unsigned char> transpose_columns(const unsigned char *columns,
+                                               size_t num_bytes, size_t num_ots)
+  {
+    static_assert(OT_EXTENSION_WIDTH % 16 == 0,
+                  "Columns are transposed 16 at a time");
+    const size_t row_bytes = OT_EXTENSION_WIDTH / 8;
+    std::vector<unsigned char> rows(num_ots * row_bytes, 0);
+    // Byte b of every column holds bits of OTs 8b to 8b + 7, the last of
+    // which may be past num_ots.
+    for (size_t b = 0; 8 * b < num_ots; b++)
+    {
+      const size_t ots_in_byte = std::min<size_t>(8, num_ots - 8 * b);
+      unsigned char *out = &rows[8 * b * row_bytes];
+#ifdef __SSE2__
+      // Lane m holds byte b of column i + m. The top bit of every lane, which
+      // _mm_movemask_epi8 gathers, is then 16 bits of one row.
+      for (size_t i = 0; i < OT_EXTENSION_WIDTH; i += 16)
+      {
+        unsigned char lanes[16];
+        for (size_t m = 0; m < 16; m++)
+        {
+          lanes[m] = columns[(i + m) * num_bytes + b];
+        }
+        __m128i v = _mm_loadu_si128((const __m128i *)lanes);
+        for (size_t k = 8; k-- > 0;)
+        {
+          int mask = _mm_movemask_epi8(v);
+          if (k < ots_in_byte)
+          {
+            out[k * row_bytes + i / 8] = mask & 0xff;
+            out[k * row_bytes + i / 8 + 1] = mask >> 8;
+          }
+          v = _mm_add_epi8(v, v);
+        }
+      }
+#else
+      for (size_t i = 0; i < OT_EXTENSION_WIDTH; i += 8)
+      {
+        uint64_t block = 0;
+        for (size_t m = 0; m < 8; m++)
+        {
+          block |= (uint64_t)columns[(i + m) * num_bytes + b] << (8 * m);
+        }
+        block = transpose_8x8(block);
+        for (size_t k = 0; k < ots_in_byte; k++)
+        {
+          out[k * row_bytes + i / 8] = block >> (8 * k);
+        }
+      }
+#endif
+    }
+    return rows;
+  }
+
+  /*
+   * Encode a point compressed, as the group is set up to.
+   */
+  SecByteBlock encode_point(const DL_GroupParameters_EC<ECP> &group,
+                            const ECP::Point &point)
+  {
+    SecByteBlock encoded(group.GetEncodedElementSize(true));
+    group.EncodeElement(true, point, encoded);
+    return encoded;
+  }
+
+  /*
+   * Decode a point received from the other party, checking that it is a
+   * valid element of the group.
+   */
+  ECP::Point decode_point(const DL_GroupParameters_EC<ECP> &group,
+                          const SecByteBlock &encoded)
+  {
+    if (encoded.size() != group.GetEncodedElementSize(true))
+    {
+      throw std::runtime_error("Received a point of the wrong size");
+    }
+    try
+    {
+      return group.DecodeElement(encoded, true);
+    }
+    catch (CryptoPP::Exception &e)
+    {
+      throw std::runtime_error("Received an invalid point");
+    }
+  }
+
+  /*
+   * Encrypt or decrypt one option of the j-th OT of a batch. The key is
+   * H(j || B_j || P), so every option of every OT has its own key and a
+   * fixed IV is safe.
+   */
+  std::string ec_ot_crypt(uint64_t j, const SecByteBlock &B_j,
+                          const DL_GroupParameters_EC<ECP> &group,
+                          const ECP::Point &P, std::string value)
+  {
+    CryptoPP::SHA256 hash;
+    SecByteBlock digest(hash.DigestSize());
+    SecByteBlock point = encode_point(group, P);
+    hash.Update((const unsigned char *)&j, sizeof(j));
+    hash.Update(B_j, B_j.size());
+    hash.Update(point, point.size());
+    hash.Final(digest);
+
+    SecByteBlock iv(AES::BLOCKSIZE);
+    std::memset(iv, 0, iv.size());
+    CTR_Mode<AES>::Encryption cipher(digest, AES::DEFAULT_KEYLENGTH, iv);
+    cipher.ProcessString((unsigned char *)value.data(), value.size());
+    return value;
+  }
+}
+
 /*
  * Constructor
  */
 OTDriver::OTDriver(
-    int other_party,
+    std::shared_ptr<boost::asio::ip::tcp::socket> socket,
     std::shared_ptr<NetworkDriver> network_driver,
     std::shared_ptr<CryptoDriver> crypto_driver,
-    std::pair<CryptoPP::SecByteBlock, CryptoPP::SecByteBlock> keys)
+    std::shared_ptr<AEADSession> session)
 {
-  this->other_party = other_party;
+  this->socket = socket;
   this->network_driver = network_driver;
   this->crypto_driver = crypto_driver;
-  this->AES_key = keys.first;
-  this->HMAC_key = keys.second;
-  this->cli_driver = std::make_shared<CLIDriver>();
+  this->session = session;
+  this->ot_counter = 0;
 }
 
 /*
- * Send one of m[0], ..., m[n - 1] using OT, where n = m.size(). This function
- * should:
- * 1) Sample a public DH value and send it to the receiver
- * 2) Receive the receiver's public value
- * 3) Encrypt m[0], ..., m[n - 1] using different keys
- * 4) Send the encrypted values
- * You may find `byteblock_to_integer` and `integer_to_byteblock` useful
- * Disconnect and throw errors only for invalid MACs
+ * Send one of m[0], ..., m[n - 1] using OT, where n = m.size().
  */
 void OTDriver::OT_send(std::vector<std::string> m)
 {
-  // Implement me!
-  // auto &mod_inv = CryptoPP::EuclideanMultiplicativeInverse;
-  // auto [dh_obj, dh_priv_key, dh_pub_key] = crypto_driver->DH_initialize();
-
-  // // 1) Sample a public DH value and send it to the receiver
-  // SenderToReceiver_OTPublicValue_Message sender_pub_key_msg;
-  // sender_pub_key_msg.public_value = dh_pub_key;
-  // std::vector<unsigned char> bytes =
-  //     crypto_driver->encrypt_and_tag(AES_key, HMAC_key, &sender_pub_key_msg);
-  // network_driver->send(other_party, bytes);
-
-  // // 2) Receive the receiver's public value
-  // bytes = network_driver->read(other_party);
-  // auto [plain_bytes, verified] =
-  //     crypto_driver->decrypt_and_verify(AES_key, HMAC_key, bytes);
-  // if (!verified)
-  // {
-  //   network_driver->disconnect(other_party);
-  //   throw std::runtime_error(
-  //       "OT_send: Received invalid HMAC for receiver's public value");
-  // }
-  // ReceiverToSender_OTPublicValue_Message receiver_pub_key_msg;
-  // receiver_pub_key_msg.deserialize(plain_bytes);
-
-  // // 3) Encrypt m[0], ..., m[n - 1] using different keys
-  // CryptoPP::Integer B = byteblock_to_integer(receiver_pub_key_msg.public_value);
-  // CryptoPP::Integer A = byteblock_to_integer(dh_pub_key);
-  // CryptoPP::Integer a = byteblock_to_integer(dh_priv_key);
-
-  // SenderToReceiver_OTEncryptedValues_Message ot_msg;
-  // for (int i = 0; i < m.size(); i++)
-  // {
-  //   // HKDF input: (B / A^i)^a
-  //   CryptoPP::Integer k_i = (B * mod_inv(mod_exp(A, i, DL_P), DL_P)) % DL_P;
-
-  //   auto k_to_hash = crypto_driver->DH_generate_shared_key(
-  //       dh_obj, dh_priv_key, integer_to_byteblock(k_i));
-  //   SecByteBlock k = crypto_driver->AES_generate_key(k_to_hash);
-  //   auto [e, iv] = crypto_driver->AES_encrypt(k, m[i]);
-
-  //   ot_msg.encryptions.push_back(e);
-  //   ot_msg.ivs.push_back(iv);
-  // }
-
-  // // 4) Send the encrypted values
-  // bytes = crypto_driver->encrypt_and_tag(AES_key, HMAC_key, &ot_msg);
-  // network_driver->send(other_party, bytes);
-}
-
-/*
- * Receive m_c using OT. This function should:
- * 1) Read the sender's public value
- * 2) Respond with our public value that depends on our choice bit
- * 3) Generate the appropriate key and decrypt the appropriate ciphertext
- * You may find `byteblock_to_integer` and `integer_to_byteblock` useful
- * Disconnect and throw errors only for invalid MACs
+  OT_send_batch({m});
+}
+
+/*
+ * Receive m_c using OT.
  */
 std::string OTDriver::OT_recv(int choice_bit)
 {
-  // Implement me!
-  // 1) Read the sender's public value
-  // std::vector<unsigned char> bytes = network_driver->read(other_party);
-  // auto [plain_bytes, verified] =
-  //     crypto_driver->decrypt_and_verify(AES_key, HMAC_key, bytes);
-  // if (!verified)
-  // {
-  //   network_driver->disconnect(other_party);
-  //   throw std::runtime_error(
-  //       "OT_recv: Received invalid HMAC for sender's public value");
-  // }
-  // SenderToReceiver_OTPublicValue_Message sender_pub_key_msg;
-  // sender_pub_key_msg.deserialize(plain_bytes);
-  // CryptoPP::Integer A = byteblock_to_integer(sender_pub_key_msg.public_value);
-
-  // // 2) Respond with our public value that depends on our choice bit
-  // auto [dh_obj, dh_priv_key, dh_pub_key] = crypto_driver->DH_initialize();
-
-  // ReceiverToSender_OTPublicValue_Message receiver_pub_key_msg;
-  // CryptoPP::Integer B = byteblock_to_integer(dh_pub_key);
-  // B = (B * mod_exp(A, choice_bit, DL_P)) % DL_P;
-  // dh_pub_key = integer_to_byteblock(B);
-  // receiver_pub_key_msg.public_value = dh_pub_key;
-  // bytes =
-  //     crypto_driver->encrypt_and_tag(AES_key, HMAC_key, &receiver_pub_key_msg);
-  // network_driver->send(other_party, bytes);
-
-  // // 3) Generate the appropriate key and decrypt the appropriate ciphertext
-  // bytes = network_driver->read(other_party);
-  // auto [plain_bytes_2, verified_2] =
-  //     crypto_driver->decrypt_and_verify(AES_key, HMAC_key, bytes);
-  // if (!verified)
-  // {
-  //   network_driver->disconnect(other_party);
-  //   throw std::runtime_error(
-  //       "OT_recv: Received invalid HMAC for sender's final message");
-  // }
-
-  // SenderToReceiver_OTEncryptedValues_Message ot_msg;
-  // ot_msg.deserialize(plain_bytes_2);
-  // auto kc_to_hash = crypto_driver->DH_generate_shared_key(
-  //     dh_obj, dh_priv_key, sender_pub_key_msg.public_value);
-  // SecByteBlock kc = crypto_driver->AES_generate_key(kc_to_hash);
-
-  // return crypto_driver->AES_decrypt(kc, ot_msg.ivs[choice_bit],
-  //                                   ot_msg.encryptions[choice_bit]);
-  return "";
-}
\ No newline at end of file
+  return OT_recv_batch({choice_bit})[0];
+}
+
+/*
+ * Run m.size() independent OTs at once over P-256, where the j-th OT sends one
+ * of m[j][0], ..., m[j][n - 1]. This is the Simplest OT of Chou and Orlandi:
+ * one sender point serves the whole batch, so the batch costs one point, one
+ * point per OT back, and the ciphertexts. This function:
+ * 1) Samples a and sends A = aG
+ * 2) Receives the receiver's points B_j = bG + cA
+ * 3) Encrypts m[j][i] under H(j, B_j, a(B_j - iA)), which the receiver can
+ *    compute as H(j, B_j, bA) only for i = c
+ * 4) Sends the encryptions
+ * Throws errors only for invalid MACs and invalid points
+ */
+void OTDriver::OT_send_batch(std::vector<std::vector<std::string>> m)
+{
+  this->base_ots += m.size();
+  const DL_GroupParameters_EC<ECP> &group = crypto_driver->EC_group();
+  const ECP &curve = group.GetCurve();
+  PRG &rng = PRG::local();
+  CryptoTimer timer(*session);
+
+  // 1) Sample a and send A = aG
+  CryptoPP::Integer a(rng, CryptoPP::Integer::One(), group.GetMaxExponent());
+  ECP::Point A = group.ExponentiateBase(a);
+  SenderToReceiver_ECOTPublicValue_Message sender_msg;
+  sender_msg.public_value = encode_point(group, A);
+  timer.pause();
+  std::vector<unsigned char> bytes = crypto_driver->encrypt_and_tag(
+      *session, MessageType::SenderToReceiver_ECOTPublicValue_Message, &sender_msg);
+  network_driver->socket_send(socket, std::move(bytes),
+                              MessageType::SenderToReceiver_ECOTPublicValue_Message);
+
+  // 2) Receive the receiver's points
+  bytes = network_driver->socket_read(
+      socket, MessageType::ReceiverToSender_ECOTPublicValueBatch_Message);
+  auto [plain_bytes, verified] = crypto_driver->decrypt_and_verify(
+      *session, MessageType::ReceiverToSender_ECOTPublicValueBatch_Message, std::move(bytes));
+  if (!verified)
+  {
+    throw std::runtime_error(
+        "OT_send: Received invalid MAC for receiver's public values");
+  }
+  ReceiverToSender_ECOTPublicValueBatch_Message receiver_msg;
+  receiver_msg.deserialize(plain_bytes);
+  if (receiver_msg.public_values.size() != m.size())
+  {
+    throw std::runtime_error(
+        "OT_send: Received wrong number of receiver public values");
+  }
+
+  // 3) Encrypt m[j][i]. a(B_j - iA) = aB_j - i(aA), so after one scalar
+  // multiplication per OT each option is one point addition away.
+  timer.resume();
+  ECP::Point minus_aA = curve.Inverse(group.ExponentiateElement(A, a));
+  SenderToReceiver_ECOTEncryptedValuesBatch_Message ot_msg;
+  ot_msg.encryptions.resize(m.size());
+  for (size_t j = 0; j < m.size(); j++)
+  {
+    const SecByteBlock &B_j = receiver_msg.public_values[j];
+    ECP::Point P = group.ExponentiateElement(decode_point(group, B_j), a);
+    for (size_t i = 0; i < m[j].size(); i++)
+    {
+      if (i > 0)
+      {
+        P = curve.Add(P, minus_aA);
+      }
+      ot_msg.encryptions[j].push_back(ec_ot_crypt(j, B_j, group, P, m[j][i]));
+    }
+  }
+
+  // 4) Send the encryptions
+  timer.pause();
+  bytes = crypto_driver->encrypt_and_tag(
+      *session, MessageType::SenderToReceiver_ECOTEncryptedValuesBatch_Message, &ot_msg);
+  network_driver->socket_send(
+      socket, std::move(bytes), MessageType::SenderToReceiver_ECOTEncryptedValuesBatch_Message);
+}
+
+/*
+ * Receive m[j][choice_bits[j]] for every OT of an OT_send_batch. This
+ * function:
+ * 1) Reads the sender's point A
+ * 2) Samples b_j and responds with B_j = b_jG + c_jA for every OT
+ * 3) Decrypts the chosen encryptions with H(j, B_j, b_jA)
+ * Throws errors only for invalid MACs and invalid points
+ */
+std::vector<std::string> OTDriver::OT_recv_batch(std::vector<int> choice_bits)
+{
+  this->base_ots += choice_bits.size();
+  const DL_GroupParameters_EC<ECP> &group = crypto_driver->EC_group();
+  const ECP &curve = group.GetCurve();
+  PRG &rng = PRG::local();
+
+  // 1) Read the sender's point
+  std::vector<unsigned char> bytes = network_driver->socket_read(
+      socket, MessageType::SenderToReceiver_ECOTPublicValue_Message);
+  auto [plain_bytes, verified] = crypto_driver->decrypt_and_verify(
+      *session, MessageType::SenderToReceiver_ECOTPublicValue_Message, std::move(bytes));
+  if (!verified)
+  {
+    throw std::runtime_error(
+        "OT_recv: Received invalid MAC for sender's public value");
+  }
+  SenderToReceiver_ECOTPublicValue_Message sender_msg;
+  sender_msg.deserialize(plain_bytes);
+  ECP::Point A = decode_point(group, sender_msg.public_value);
+
+  // 2) Respond with B_j = b_jG + c_jA. multiples[c] is cA.
+  CryptoTimer timer(*session);
+  std::vector<ECP::Point> multiples = {curve.Identity()};
+  std::vector<CryptoPP::Integer> b(choice_bits.size());
+  ReceiverToSender_ECOTPublicValueBatch_Message receiver_msg;
+  for (size_t j = 0; j < choice_bits.size(); j++)
+  {
+    if (choice_bits[j] < 0)
+    {
+      throw std::runtime_error("OT_recv: Negative choice");
+    }
+    while (multiples.size() <= choice_bits[j])
+    {
+      multiples.push_back(curve.Add(multiples.back(), A));
+    }
+    b[j] = CryptoPP::Integer(rng, CryptoPP::Integer::One(), group.GetMaxExponent());
+    ECP::Point B = curve.Add(group.ExponentiateBase(b[j]), multiples[choice_bits[j]]);
+    receiver_msg.public_values.push_back(encode_point(group, B));
+  }
+  timer.pause();
+  bytes = crypto_driver->encrypt_and_tag(
+      *session, MessageType::ReceiverToSender_ECOTPublicValueBatch_Message, &receiver_msg);
+  network_driver->socket_send(
+      socket, std::move(bytes), MessageType::ReceiverToSender_ECOTPublicValueBatch_Message);
+
+  // 3) Decrypt the chosen encryptions
+  bytes = network_driver->socket_read(
+      socket, MessageType::SenderToReceiver_ECOTEncryptedValuesBatch_Message);
+  auto [plain_bytes_2, verified_2] = crypto_driver->decrypt_and_verify(
+      *session, MessageType::SenderToReceiver_ECOTEncryptedValuesBatch_Message, std::move(bytes));
+  if (!verified_2)
+  {
+    throw std::runtime_error(
+        "OT_recv: Received invalid MAC for sender's final message");
+  }
+  SenderToReceiver_ECOTEncryptedValuesBatch_Message ot_msg;
+  ot_msg.deserialize(plain_bytes_2);
+  if (ot_msg.encryptions.size() != choice_bits.size())
+  {
+    throw std::runtime_error(
+        "OT_recv: Received wrong number of encrypted values");
+  }
+
+  timer.resume();
+  std::vector<std::string> results;
+  for (size_t j = 0; j < choice_bits.size(); j++)
+  {
+    if (choice_bits[j] >= ot_msg.encryptions[j].size())
+    {
+      throw std::runtime_error("OT_recv: Choice out of range");
+    }
+    ECP::Point P = group.ExponentiateElement(A, b[j]);
+    results.push_back(ec_ot_crypt(j, receiver_msg.public_values[j], group, P,
+                                  ot_msg.encryptions[j][choice_bits[j]]));
+  }
+  return results;
+}
+
+/*
+ * Run m.size() independent OTs in the 2048-bit DL group at once, where the
+ * j-th OT sends one of m[j][0], ..., m[j][n - 1]. The values of every OT are
+ * sent together, so the whole batch costs one round trip plus one message.
+ * Superseded by OT_send_batch, which does the same over P-256. This function:
+ * 1) Samples a public DH value per OT and sends them to the receiver
+ * 2) Receives the receiver's public values
+ * 3) Encrypts m[j][0], ..., m[j][n - 1] using different keys
+ * 4) Sends the encrypted values
+ * Throws errors only for invalid MACs
+ */
+void OTDriver::DL_OT_send_batch(std::vector<std::vector<std::string>> m)
+{
+  CryptoPP::ModularArithmetic group(DL_P);
+
+  // 1) Sample a public DH value per OT and send them to the receiver
+  std::vector<std::tuple<const DH &, SecByteBlock, SecByteBlock>> dh_values;
+  SenderToReceiver_OTPublicValueBatch_Message sender_pub_key_msg;
+  for (size_t j = 0; j < m.size(); j++)
+  {
+    dh_values.push_back(crypto_driver->DH_initialize());
+    sender_pub_key_msg.public_values.push_back(std::get<2>(dh_values[j]));
+  }
+  std::vector<unsigned char> bytes = crypto_driver->encrypt_and_tag(
+      *session, MessageType::SenderToReceiver_OTPublicValueBatch_Message, &sender_pub_key_msg);
+  network_driver->socket_send(socket, std::move(bytes),
+                              MessageType::SenderToReceiver_OTPublicValueBatch_Message);
+
+  // 2) Receive the receiver's public values
+  bytes = network_driver->socket_read(
+      socket, MessageType::ReceiverToSender_OTPublicValueBatch_Message);
+  auto [plain_bytes, verified] = crypto_driver->decrypt_and_verify(
+      *session, MessageType::ReceiverToSender_OTPublicValueBatch_Message, std::move(bytes));
+  if (!verified)
+  {
+    throw std::runtime_error(
+        "DL_OT_send: Received invalid HMAC for receiver's public values");
+  }
+  ReceiverToSender_OTPublicValueBatch_Message receiver_pub_key_msg;
+  receiver_pub_key_msg.deserialize(plain_bytes);
+  if (receiver_pub_key_msg.public_values.size() != m.size())
+  {
+    throw std::runtime_error(
+        "DL_OT_send: Received wrong number of receiver public values");
+  }
+
+  // 3) Encrypt m[j][0], ..., m[j][n - 1] using different keys
+  SenderToReceiver_OTEncryptedValuesBatch_Message ot_msg;
+  ot_msg.encryptions.resize(m.size());
+  ot_msg.ivs.resize(m.size());
+  for (size_t j = 0; j < m.size(); j++)
+  {
+    auto &[dh_obj, dh_priv_key, dh_pub_key] = dh_values[j];
+    CryptoPP::Integer B =
+        byteblock_to_integer(receiver_pub_key_msg.public_values[j]);
+    CryptoPP::Integer A_inv =
+        group.MultiplicativeInverse(byteblock_to_integer(dh_pub_key));
+
+    // B / A^i for each i in turn, one multiplication apart
+    CryptoPP::Integer k_i = B % DL_P;
+    for (int i = 0; i < m[j].size(); i++)
+    {
+      // HKDF input: (B / A^i)^a
+      if (i > 0)
+      {
+        k_i = group.Multiply(k_i, A_inv);
+      }
+
+      auto k_to_hash = crypto_driver->DH_generate_shared_key(
+          dh_obj, dh_priv_key, integer_to_byteblock(k_i));
+      SecByteBlock k = crypto_driver->AES_generate_key(k_to_hash);
+      auto [e, iv] = crypto_driver->AES_encrypt(k, m[j][i]);
+
+      ot_msg.encryptions[j].push_back(e);
+      ot_msg.ivs[j].push_back(iv);
+    }
+  }
+
+  // 4) Send the encrypted values
+  bytes = crypto_driver->encrypt_and_tag(
+      *session, MessageType::SenderToReceiver_OTEncryptedValuesBatch_Message, &ot_msg);
+  network_driver->socket_send(
+      socket, std::move(bytes), MessageType::SenderToReceiver_OTEncryptedValuesBatch_Message);
+}
+
+/*
+ * Receive m[j][choice_bits[j]] for every OT of a DL_OT_send_batch. This
+ * function:
+ * 1) Reads the sender's public values
+ * 2) Responds with our public values that depend on our choice bits
+ * 3) Generates the appropriate keys and decrypts the appropriate ciphertexts
+ * Throws errors only for invalid MACs
+ */
+std::vector<std::string> OTDriver::DL_OT_recv_batch(std::vector<int> choice_bits)
+{
+  // 1) Read the sender's public values
+  std::vector<unsigned char> bytes = network_driver->socket_read(
+      socket, MessageType::SenderToReceiver_OTPublicValueBatch_Message);
+  auto [plain_bytes, verified] = crypto_driver->decrypt_and_verify(
+      *session, MessageType::SenderToReceiver_OTPublicValueBatch_Message, std::move(bytes));
+  if (!verified)
+  {
+    throw std::runtime_error(
+        "DL_OT_recv: Received invalid HMAC for sender's public values");
+  }
+  SenderToReceiver_OTPublicValueBatch_Message sender_pub_key_msg;
+  sender_pub_key_msg.deserialize(plain_bytes);
+  if (sender_pub_key_msg.public_values.size() != choice_bits.size())
+  {
+    throw std::runtime_error(
+        "DL_OT_recv: Received wrong number of sender public values");
+  }
+
+  // 2) Respond with our public values that depend on our choice bits
+  std::vector<std::tuple<const DH &, SecByteBlock, SecByteBlock>> dh_values;
+  ReceiverToSender_OTPublicValueBatch_Message receiver_pub_key_msg;
+  for (size_t j = 0; j < choice_bits.size(); j++)
+  {
+    CryptoPP::Integer A =
+        byteblock_to_integer(sender_pub_key_msg.public_values[j]);
+    auto [dh_obj, dh_priv_key, dh_pub_key] = crypto_driver->DH_initialize();
+
+    CryptoPP::Integer B = byteblock_to_integer(dh_pub_key);
+    B = (B * mod_exp(A, choice_bits[j], DL_P)) % DL_P;
+    receiver_pub_key_msg.public_values.push_back(integer_to_byteblock(B));
+    dh_values.emplace_back(dh_obj, dh_priv_key, dh_pub_key);
+  }
+  bytes = crypto_driver->encrypt_and_tag(
+      *session, MessageType::ReceiverToSender_OTPublicValueBatch_Message, &receiver_pub_key_msg);
+  network_driver->socket_send(
+      socket, std::move(bytes), MessageType::ReceiverToSender_OTPublicValueBatch_Message);
+
+  // 3) Generate the appropriate keys and decrypt the appropriate ciphertexts
+  bytes = network_driver->socket_read(
+      socket, MessageType::SenderToReceiver_OTEncryptedValuesBatch_Message);
+  auto [plain_bytes_2, verified_2] = crypto_driver->decrypt_and_verify(
+      *session, MessageType::SenderToReceiver_OTEncryptedValuesBatch_Message, std::move(bytes));
+  if (!verified_2)
+  {
+    throw std::runtime_error(
+        "DL_OT_recv: Received invalid HMAC for sender's final message");
+  }
+
+  SenderToReceiver_OTEncryptedValuesBatch_Message ot_msg;
+  ot_msg.deserialize(plain_bytes_2);
+  if (ot_msg.encryptions.size() != choice_bits.size())
+  {
+    throw std::runtime_error(
+        "DL_OT_recv: Received wrong number of encrypted values");
+  }
+
+  std::vector<std::string> results;
+  for (size_t j = 0; j < choice_bits.size(); j++)
+  {
+    auto &[dh_obj, dh_priv_key, dh_pub_key] = dh_values[j];
+    auto kc_to_hash = crypto_driver->DH_generate_shared_key(
+        dh_obj, dh_priv_key, sender_pub_key_msg.public_values[j]);
+    SecByteBlock kc = crypto_driver->AES_generate_key(kc_to_hash);
+
+    results.push_back(crypto_driver->AES_decrypt(
+        kc, ot_msg.ivs[j][choice_bits[j]],
+        ot_msg.encryptions[j][choice_bits[j]]));
+  }
+
+  return results;
+}
+
+/*
+ * Set up OT extension as the extension sender. This function should:
+ * 1) Sample a random secret s of OT_EXTENSION_WIDTH bits
+ * 2) Receive seed k_i^{s_i} in the i-th base OT
+ * 3) Seed one PRG per column with the received seeds
+ */
+void OTDriver::OT_extension_setup_sender()
+{
+  // 1) Sample a random secret s
+  PRG &rng = PRG::local();
+  this->extension_secret = SecByteBlock(OT_EXTENSION_WIDTH / 8);
+  rng.GenerateBlock(this->extension_secret, this->extension_secret.size());
+
+  // 2) Receive k_i^{s_i} in the i-th base OT
+  std::vector<int> choice_bits;
+  for (int i = 0; i < OT_EXTENSION_WIDTH; i++)
+  {
+    choice_bits.push_back(get_packed_bit(this->extension_secret, i));
+  }
+  std::vector<std::string> seeds = OT_recv_batch(choice_bits);
+
+  // 3) Seed one PRG per column
+  this->column_prgs_0.clear();
+  for (int i = 0; i < OT_EXTENSION_WIDTH; i++)
+  {
+    this->column_prgs_0.push_back(
+        std::make_unique<PRG>(string_to_byteblock(seeds[i])));
+  }
+}
+
+/*
+ * Set up OT extension as the extension receiver. This function should:
+ * 1) Sample OT_EXTENSION_WIDTH pairs of random seeds (k_i^0, k_i^1)
+ * 2) Send both seeds of the i-th pair in the i-th base OT
+ * 3) Seed two PRGs per column with the seeds
+ */
+void OTDriver::OT_extension_setup_receiver()
+{
+  // 1) Sample OT_EXTENSION_WIDTH pairs of random seeds
+  PRG &rng = PRG::local();
+  std::vector<std::vector<std::string>> seeds;
+  for (int i = 0; i < OT_EXTENSION_WIDTH; i++)
+  {
+    SecByteBlock seed_0(AES::DEFAULT_KEYLENGTH);
+    SecByteBlock seed_1(AES::DEFAULT_KEYLENGTH);
+    rng.GenerateBlock(seed_0, seed_0.size());
+    rng.GenerateBlock(seed_1, seed_1.size());
+    seeds.push_back({byteblock_to_string(seed_0), byteblock_to_string(seed_1)});
+  }
+
+  // 2) Send both seeds in the i-th base OT
+  OT_send_batch(seeds);
+
+  // 3) Seed two PRGs per column
+  this->column_prgs_0.clear();
+  this->column_prgs_1.clear();
+  for (int i = 0; i < OT_EXTENSION_WIDTH; i++)
+  {
+    this->column_prgs_0.push_back(
+        std::make_unique<PRG>(string_to_byteblock(seeds[i][0])));
+    this->column_prgs_1.push_back(
+        std::make_unique<PRG>(string_to_byteblock(seeds[i][1])));
+  }
+}
+
+/*
+ * Hash the index-th row of the extension matrix into a key. H(index || row)
+ */
+SecByteBlock OTDriver::hash_row(uint64_t index, const unsigned char *row)
+{
+  SecByteBlock index_block((const unsigned char *)&index, sizeof(index));
+  SecByteBlock row_block(row, OT_EXTENSION_WIDTH / 8);
+  return crypto_driver->hash_inputs(index_block, row_block);
+}
+
+/*
+ * Produce num_ots random 1-out-of-4 OTs as the extension sender (KK13). The
+ * receiver's choice c is spread over the columns with the code C of
+ * code_bit, so row q_j = t_j XOR (C(c_j) AND s). This function should:
+ * 1) Receive the receiver's matrix u
+ * 2) Compute column q_i = G(k_i^{s_i}) XOR s_i * u_i
+ * 3) Transpose, so that row q_j = t_j XOR (C(c_j) AND s)
+ * 4) Output keys H(j, q_j XOR (C(c) AND s)) for c = 0, ..., 3. Only the key
+ *    of c_j equals H(j, t_j); the others differ from it in at least
+ *    OT_EXTENSION_WIDTH * 2 / 3 bits of s.
+ * Throws errors only for invalid MACs
+ */
+std::vector<std::array<SecByteBlock, 4>>
+OTDriver::ROT4_extension_send(int num_ots)
+{
+  const size_t num_bytes = (num_ots + 7) / 8;
+  const size_t row_bytes = OT_EXTENSION_WIDTH / 8;
+
+  // 1) Receive the receiver's matrix u
+  std::vector<unsigned char> bytes = network_driver->socket_read(
+      socket, MessageType::ReceiverToSender_OTExtensionMatrix_Message);
+  auto [plain_bytes, verified] = crypto_driver->decrypt_and_verify(
+      *session, MessageType::ReceiverToSender_OTExtensionMatrix_Message, std::move(bytes));
+  if (!verified)
+  {
+    throw std::runtime_error(
+        "ROT4_extension_send: Received invalid HMAC for extension matrix");
+  }
+  ReceiverToSender_OTExtensionMatrix_Message matrix_msg;
+  matrix_msg.deserialize(plain_bytes);
+  if (matrix_msg.matrix.size() != OT_EXTENSION_WIDTH * num_bytes)
+  {
+    throw std::runtime_error(
+        "ROT4_extension_send: Received extension matrix of wrong size");
+  }
+
+  // 2) Compute q_i = G(k_i^{s_i}) XOR s_i * u_i
+  CryptoTimer timer(*session);
+  std::vector<unsigned char> q(OT_EXTENSION_WIDTH * num_bytes, 0);
+  for (int i = 0; i < OT_EXTENSION_WIDTH; i++)
+  {
+    unsigned char *q_i = &q[i * num_bytes];
+    this->column_prgs_0[i]->GenerateBlock(q_i, num_bytes);
+    if (get_packed_bit(this->extension_secret, i))
+    {
+      const char *u_i = &matrix_msg.matrix[i * num_bytes];
+      for (size_t b = 0; b < num_bytes; b++)
+      {
+        q_i[b] ^= (unsigned char)u_i[b];
+      }
+    }
+  }
+
+  // 3) Transpose
+  std::vector<unsigned char> rows = transpose_columns(q.data(), num_bytes, num_ots);
+
+  // 4) Output keys. C(c) AND s is the same for every OT.
+  std::vector<unsigned char> code_and_s(4 * row_bytes, 0);
+  for (int c = 0; c < 4; c++)
+  {
+    for (int i = 0; i < OT_EXTENSION_WIDTH; i++)
+    {
+      set_packed_bit(&code_and_s[c * row_bytes], i,
+                     code_bit(c, i) & get_packed_bit(this->extension_secret, i));
+    }
+  }
+  std::vector<std::array<SecByteBlock, 4>> keys(num_ots);
+  std::vector<unsigned char> row(row_bytes);
+  for (int j = 0; j < num_ots; j++)
+  {
+    const unsigned char *q_j = &rows[j * row_bytes];
+    for (int c = 0; c < 4; c++)
+    {
+      for (size_t b = 0; b < row_bytes; b++)
+      {
+        row[b] = q_j[b] ^ code_and_s[c * row_bytes + b];
+      }
+      keys[j][c] = hash_row(this->ot_counter + j, row.data());
+    }
+  }
+  this->ot_counter += num_ots;
+
+  return keys;
+}
+
+/*
+ * Produce random 1-out-of-4 OTs with the given choices as the extension
+ * receiver (KK13). This function should:
+ * 1) Compute column t_i = G(k_i^0) and u_i = t_i XOR G(k_i^1) XOR C_i, where
+ *    bit j of C_i is bit i of the codeword C(c_j)
+ * 2) Send the matrix u to the sender
+ * 3) Transpose t, and output key H(j, t_j) for every OT
+ */
+std::vector<SecByteBlock>
+OTDriver::ROT4_extension_recv(std::vector<int> choices)
+{
+  const size_t num_ots = choices.size();
+  const size_t num_bytes = (num_ots + 7) / 8;
+  const size_t row_bytes = OT_EXTENSION_WIDTH / 8;
+
+  // The code has only three distinct columns.
+  CryptoTimer timer(*session);
+  std::vector<std::vector<unsigned char>> code_columns(3, std::vector<unsigned char>(num_bytes, 0));
+  for (size_t j = 0; j < num_ots; j++)
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      set_packed_bit(code_columns[i].data(), j, code_bit(choices[j], i));
+    }
+  }
+
+  // 1) Compute t_i = G(k_i^0) and u_i = t_i XOR G(k_i^1) XOR C_i
+  std::vector<unsigned char> t(OT_EXTENSION_WIDTH * num_bytes, 0);
+  ReceiverToSender_OTExtensionMatrix_Message matrix_msg;
+  matrix_msg.matrix.resize(OT_EXTENSION_WIDTH * num_bytes, 0);
+  for (int i = 0; i < OT_EXTENSION_WIDTH; i++)
+  {
+    unsigned char *t_i = &t[i * num_bytes];
+    unsigned char *u_i = (unsigned char *)&matrix_msg.matrix[i * num_bytes];
+    const unsigned char *c_i = code_columns[i % 3].data();
+    this->column_prgs_0[i]->GenerateBlock(t_i, num_bytes);
+    this->column_prgs_1[i]->GenerateBlock(u_i, num_bytes);
+    for (size_t b = 0; b < num_bytes; b++)
+    {
+      u_i[b] ^= t_i[b] ^ c_i[b];
+    }
+  }
+
+  // 2) Send the matrix u
+  timer.pause();
+  std::vector<unsigned char> bytes = crypto_driver->encrypt_and_tag(
+      *session, MessageType::ReceiverToSender_OTExtensionMatrix_Message, &matrix_msg);
+  network_driver->socket_send(
+      socket, std::move(bytes), MessageType::ReceiverToSender_OTExtensionMatrix_Message);
+
+  // 3) Transpose t and output keys
+  timer.resume();
+  std::vector<unsigned char> rows = transpose_columns(t.data(), num_bytes, num_ots);
+  std::vector<SecByteBlock> keys;
+  for (size_t j = 0; j < num_ots; j++)
+  {
+    keys.push_back(hash_row(this->ot_counter + j, &rows[j * row_bytes]));
+  }
+  this->ot_counter += num_ots;
+
+  return keys;
+}
+
+/*
+ * Drop the random OTs that have been used, before appending new ones.
+ */
+void OTDriver::take_rot4_pool_prefix()
+{
+  this->rot4_pool.erase(this->rot4_pool.begin(),
+                        this->rot4_pool.begin() + this->rot4_next);
+  this->rot4_next = 0;
+}
+
+/*
+ * Precompute num_ots random 1-out-of-4 OTs as the sender. r_c is the low bit
+ * of the key of choice c.
+ */
+void OTDriver::ROT4_precompute_send(int num_ots)
+{
+  if (num_ots <= 0)
+  {
+    return;
+  }
+  this->random_ots += num_ots;
+  auto keys = ROT4_extension_send(num_ots);
+
+  take_rot4_pool_prefix();
+  for (int j = 0; j < num_ots; j++)
+  {
+    unsigned char r = 0;
+    for (int c = 0; c < 4; c++)
+    {
+      r |= (keys[j][c][0] & 1) << c;
+    }
+    this->rot4_pool.push_back(r);
+  }
+}
+
+/*
+ * Precompute num_ots random 1-out-of-4 OTs as the receiver, with random
+ * choices d.
+ */
+void OTDriver::ROT4_precompute_recv(int num_ots)
+{
+  if (num_ots <= 0)
+  {
+    return;
+  }
+  this->random_ots += num_ots;
+  PRG &rng = PRG::local();
+  std::vector<unsigned char> random_bytes(num_ots);
+  rng.GenerateBlock(random_bytes.data(), random_bytes.size());
+  std::vector<int> choices(num_ots);
+  for (int j = 0; j < num_ots; j++)
+  {
+    choices[j] = random_bytes[j] & 3;
+  }
+  auto keys = ROT4_extension_recv(choices);
+
+  take_rot4_pool_prefix();
+  for (int j = 0; j < num_ots; j++)
+  {
+    int r_d = keys[j][0] & 1;
+    this->rot4_pool.push_back(choices[j] | (r_d << 2));
+  }
+}
+
+/*
+ * Send one of m[j][0], ..., m[j][3] for every OT in a batch, where each option
+ * is a bit. Derandomizes one precomputed random OT per OT: the receiver sends
+ * e = c XOR d, and option i goes out masked with r_{i XOR e}, so the receiver
+ * can unmask option c with r_d and nothing else. This function:
+ * 1) Tops up the pool if it is short
+ * 2) Receives the offsets e
+ * 3) Sends m[j][i] XOR r_{i XOR e} for every OT and option
+ */
+void OTDriver::OT_extension_send(std::vector<std::vector<int>> m)
+{
+  this->derandomized_ots += m.size();
+  // 1) Top up the pool
+  size_t available = this->rot4_pool.size() - this->rot4_next;
+  if (available < m.size())
+  {
+    ROT4_precompute_send(m.size() - available);
+  }
+
+  // 2) Receive the offsets
+  std::vector<unsigned char> bytes = network_driver->socket_read(
+      socket, MessageType::ReceiverToSender_OTChoiceOffsets_Message);
+  auto [plain_bytes, verified] = crypto_driver->decrypt_and_verify(
+      *session, MessageType::ReceiverToSender_OTChoiceOffsets_Message, std::move(bytes));
+  if (!verified)
+  {
+    throw std::runtime_error(
+        "OT_extension_send: Received invalid HMAC for choice offsets");
+  }
+  ReceiverToSender_OTChoiceOffsets_Message offsets_msg;
+  offsets_msg.deserialize(plain_bytes);
+  if (offsets_msg.offsets.size() != (2 * m.size() + 7) / 8)
+  {
+    throw std::runtime_error(
+        "OT_extension_send: Received choice offsets of wrong size");
+  }
+  const unsigned char *offsets = (const unsigned char *)offsets_msg.offsets.data();
+
+  // 3) Send the masked options
+  CryptoTimer timer(*session);
+  SenderToReceiver_OTExtensionMaskedBits_Message masked_msg;
+  masked_msg.masked_bits.resize((4 * m.size() + 7) / 8, 0);
+  unsigned char *masked = (unsigned char *)&masked_msg.masked_bits[0];
+  for (size_t j = 0; j < m.size(); j++)
+  {
+    if (m[j].size() != 4)
+    {
+      throw std::runtime_error("OT_extension_send: expected four options per OT");
+    }
+
+    unsigned char r = this->rot4_pool[this->rot4_next + j];
+    int e = get_packed_bit(offsets, 2 * j) | (get_packed_bit(offsets, 2 * j + 1) << 1);
+    for (int i = 0; i < 4; i++)
+    {
+      set_packed_bit(masked, 4 * j + i, m[j][i] ^ (r >> (i ^ e)));
+    }
+  }
+  this->rot4_next += m.size();
+  timer.pause();
+
+  bytes = crypto_driver->encrypt_and_tag(
+      *session, MessageType::SenderToReceiver_OTExtensionMaskedBits_Message, &masked_msg);
+  network_driver->socket_send(
+      socket, std::move(bytes), MessageType::SenderToReceiver_OTExtensionMaskedBits_Message);
+}
+
+/*
+ * Receive m[j][choice_bits[j]] for every OT in a batch, where each option is a
+ * bit. Throws before anything is sent if a choice is outside [0, 4). This
+ * function:
+ * 1) Tops up the pool if it is short
+ * 2) Sends the offsets c XOR d
+ * 3) Unmasks option c of every OT with r_d
+ */
+std::vector<int> OTDriver::OT_extension_recv(std::vector<int> choice_bits)
+{
+  for (int c : choice_bits)
+  {
+    if (c < 0 || c > 3)
+    {
+      throw std::runtime_error("OT_extension_recv: choice " + std::to_string(c) + " is not in [0, 4)");
+    }
+  }
+  this->derandomized_ots += choice_bits.size();
+  // 1) Top up the pool
+  size_t available = this->rot4_pool.size() - this->rot4_next;
+  if (available < choice_bits.size())
+  {
+    ROT4_precompute_recv(choice_bits.size() - available);
+  }
+  const unsigned char *pool = &this->rot4_pool[this->rot4_next];
+
+  // 2) Send the offsets
+  CryptoTimer timer(*session);
+  ReceiverToSender_OTChoiceOffsets_Message offsets_msg;
+  offsets_msg.offsets.resize((2 * choice_bits.size() + 7) / 8, 0);
+  unsigned char *offsets = (unsigned char *)&offsets_msg.offsets[0];
+  for (size_t j = 0; j < choice_bits.size(); j++)
+  {
+    int e = (choice_bits[j] ^ pool[j]) & 3;
+    set_packed_bit(offsets, 2 * j, e & 1);
+    set_packed_bit(offsets, 2 * j + 1, e >> 1);
+  }
+  timer.pause();
+  std::vector<unsigned char> bytes = crypto_driver->encrypt_and_tag(
+      *session, MessageType::ReceiverToSender_OTChoiceOffsets_Message, &offsets_msg);
+  network_driver->socket_send(
+      socket, std::move(bytes), MessageType::ReceiverToSender_OTChoiceOffsets_Message);
+
+  // 3) Unmask the chosen options
+  bytes = network_driver->socket_read(
+      socket, MessageType::SenderToReceiver_OTExtensionMaskedBits_Message);
+  auto [plain_bytes, verified] = crypto_driver->decrypt_and_verify(
+      *session, MessageType::SenderToReceiver_OTExtensionMaskedBits_Message, std::move(bytes));
+  if (!verified)
+  {
+    throw std::runtime_error(
+        "OT_extension_recv: Received invalid HMAC for masked options");
+  }
+  SenderToReceiver_OTExtensionMaskedBits_Message masked_msg;
+  masked_msg.deserialize(plain_bytes);
+  if (masked_msg.masked_bits.size() != (4 * choice_bits.size() + 7) / 8)
+  {
+    throw std::runtime_error(
+        "OT_extension_recv: Received masked options of wrong size");
+  }
+
+  timer.resume();
+  const unsigned char *masked = (const unsigned char *)masked_msg.masked_bits.data();
+  std::vector<int> results;
+  for (size_t j = 0; j < choice_bits.size(); j++)
+  {
+    int c = choice_bits[j];
+    int r_d = (pool[j] >> 2) & 1;
+    results.push_back(get_packed_bit(masked, 4 * j + c) ^ r_d);
+  }
+  this->rot4_next += choice_bits.size();
+  return results;
+}
@@ -1,7 +1,7 @@
-#include <crypto++/osrng.h>
 #include <cstdlib>
 #include <iostream>
 
+#include "../../include-shared/prg.hpp"
 #include "../../include/drivers/share_driver.hpp"
 
 using namespace CryptoPP;
@@ -16,40 +16,33 @@ ShareDriver::ShareDriver(int my_party, int num_parties)
 }
 
 /**
- * If this party owns a particular wire, they need to generate secret shares for all other parties,
- * as well as themselves. These values all need to XOR to be target.
+ * Samples n uniformly random shares.
  */
-std::vector<int> ShareDriver::generate_shares(int target)
+std::vector<int> ShareDriver::generate_random_shares(int n)
 {
-    // We need to initialize a SecByteBlock with a number of bytes. If we have one bit per
-    // num_parties, then we need CEIL(num_parties / 8) bytes.
-    std::vector<int> shares(this->num_parties, 0);
-
-    // Initialize to zero, since 1 would invert the first value.
-    int xor_other_parties = 0;
-
-    CryptoPP::AutoSeededRandomPool rng;
-
-    for (int i = 0; i < this->num_parties; i++)
-    {
-        if (i == this->my_party)
-        {
-            continue;
-        }
-
-        int bit = rng.GenerateBit();
-        shares[i] = bit;
-        xor_other_parties ^= bit;
-    }
+    return PRG::local().generate_bits(n);
+}
 
-    // Finally, generate our share
-    shares[this->my_party] = (xor_other_parties ^ target);
+/**
+ * Masks our shares of x and y with our shares of a triple. Once every party's d and e
+ * shares are XORed together, d = x ^ a and e = y ^ b reveal nothing since a and b are
+ * uniformly random.
+ */
+std::pair<int, int> ShareDriver::beaver_mask(int x, int y, const BeaverTriple &triple)
+{
+    return std::make_pair(x ^ triple.a, y ^ triple.b);
+}
 
-    std::cout << "Generating share for target: " << target << std::endl;
-    for (int share : shares)
+/**
+ * x & y = (d ^ a) & (e ^ b) = (d & e) ^ (d & b) ^ (e & a) ^ c, so every party adds its
+ * shares of the terms that depend on a, b and c, and a single party adds d & e.
+ */
+int ShareDriver::beaver_combine(int d, int e, const BeaverTriple &triple)
+{
+    int share = triple.c ^ (d & triple.b) ^ (e & triple.a);
+    if (this->my_party == 0)
     {
-        std::cout << "Got share to be " << share << std::endl;
+        share ^= (d & e);
     }
-
-    return shares;
+    return share;
 }
\ No newline at end of file
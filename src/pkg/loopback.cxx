@@ -0,0 +1,38 @@
+#include "../../include/pkg/loopback.hpp"
+
+#include "../../include-shared/prg.hpp"
+
+/**
+ * Bind the sender's port, accept the receiver's connection on it, and set up
+ * the sessions and OT drivers of both sides.
+ */
+LoopbackPair::LoopbackPair(int port)
+{
+  for (LoopbackParty *party : {&this->sender, &this->receiver})
+  {
+    party->network_driver = std::make_shared<NetworkDriverImpl>();
+    party->crypto_driver = std::make_shared<CryptoDriver>();
+  }
+
+  this->port = this->sender.network_driver->bind(port);
+  auto listened = std::async(std::launch::async, [this]
+                             { return this->sender.network_driver->listen(this->port); });
+  this->receiver.socket = this->receiver.network_driver->connect(0, "127.0.0.1", this->port);
+  this->sender.socket = listened.get();
+
+  SecByteBlock shared_key(32);
+  PRG::local().GenerateBlock(shared_key, shared_key.size());
+  for (LoopbackParty *party : {&this->sender, &this->receiver})
+  {
+    bool send_first = party == &this->sender;
+    party->ot_driver = std::make_shared<OTDriver>(
+        party->socket, party->network_driver, party->crypto_driver,
+        party->crypto_driver->AEAD_session_initialize(shared_key, send_first));
+  }
+}
+
+void LoopbackPair::close()
+{
+  this->sender.network_driver->socket_close(this->sender.socket);
+  this->receiver.network_driver->socket_close(this->receiver.socket);
+}
@@ -5,7 +5,6 @@
 #include "../../include-shared/messages.hpp"
 #include "../../include-shared/logger.hpp"
 
-auto &mod_exp = CryptoPP::ModularExponentiation;
 /*
 Syntax to use logger:
   CUSTOM_LOG(lg, debug) << "your message"
@@ -17,179 +16,234 @@ namespace
 }
 
 /**
- * Constructor. Note that the OT_driver is left uninitialized.
+ * Start the worker thread.
+ */
+PeerWorker::PeerWorker()
+{
+  this->thread = std::thread(&PeerWorker::run, this);
+}
+
+/**
+ * Finish the queued tasks and stop the thread.
+ */
+PeerWorker::~PeerWorker()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->changed.notify_one();
+  this->thread.join();
+}
+
+void PeerWorker::post(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->tasks.push_back(std::move(task));
+  }
+  this->changed.notify_one();
+}
+
+void PeerWorker::run()
+{
+  while (true)
+  {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->changed.wait(lock, [&]()
+                         { return this->stopping || !this->tasks.empty(); });
+      if (this->tasks.empty())
+      {
+        return;
+      }
+      task = std::move(this->tasks.front());
+      this->tasks.pop_front();
+    }
+    task();
+  }
+}
+
+/**
+ * Constructor. Note that the OT driver is left uninitialized until
+ * SetupOTExtension is called.
  */
 PeerLink::PeerLink(std::shared_ptr<boost::asio::ip::tcp::socket> socket, std::shared_ptr<NetworkDriver> network_driver, std::shared_ptr<CryptoDriver> crypto_driver)
 {
   this->socket = socket;
   this->network_driver = network_driver;
   this->crypto_driver = crypto_driver;
+  this->worker = std::make_shared<PeerWorker>();
+}
+
+void PeerLink::Post(std::function<void()> task)
+{
+  this->worker->post(std::move(task));
 }
 
-void PeerLink::GossipSend(std::string bit_string)
+void PeerLink::Close()
+{
+  this->network_driver->socket_close(this->socket);
+}
+
+/**
+ * Cumulative traffic, crypto time and OT counts of the link so far.
+ */
+LinkMetrics PeerLink::GetMetrics()
+{
+  LinkMetrics metrics = this->network_driver->socket_metrics(this->socket);
+  if (this->session)
+  {
+    metrics.crypto_ns = this->session->crypto_ns;
+  }
+  if (this->ot_driver)
+  {
+    metrics.base_ots = this->ot_driver->base_ots;
+    metrics.random_ots = this->ot_driver->random_ots;
+    metrics.derandomized_ots = this->ot_driver->derandomized_ots;
+  }
+  return metrics;
+}
+
+/**
+ * Send our shares of the outputs the other party reconstructs, packed as bits.
+ */
+void PeerLink::SendOutputShares(std::vector<int> bits)
 {
-  FinalGossip_Message msg;
-  msg.bit_string = bit_string;
+  OutputShares_Message msg;
+  msg.bits = bits;
 
-  auto bytes = this->crypto_driver->encrypt_and_tag(AES_key, HMAC_key, &msg);
-  this->network_driver->socket_send(socket, bytes);
+  auto bytes = this->crypto_driver->encrypt_and_tag(
+      *session, MessageType::OutputShares_Message, &msg);
+  this->network_driver->socket_send(socket, std::move(bytes),
+                                    MessageType::OutputShares_Message);
 }
 
-std::string PeerLink::GossipReceive()
+std::vector<int> PeerLink::ReceiveOutputShares()
 {
-  FinalGossip_Message msg;
+  OutputShares_Message msg;
 
-  auto bytes = this->network_driver->socket_read(socket);
-  auto [data, verified] = this->crypto_driver->decrypt_and_verify(AES_key, HMAC_key, bytes);
+  auto bytes = this->network_driver->socket_read(
+      socket, MessageType::OutputShares_Message);
+  auto [data, verified] = this->crypto_driver->decrypt_and_verify(
+      *session, MessageType::OutputShares_Message, std::move(bytes));
   if (!verified)
   {
-    throw std::runtime_error("error verifying final gossip message");
+    throw std::runtime_error("error verifying output shares message");
   }
 
   msg.deserialize(data);
-  return msg.bit_string;
+  return msg.bits;
 }
 
 /*
- * Send one of m[0], ..., m[n - 1] using OT, where n = m.size(). This function
- * should:
- * 1) Sample a public DH value and send it to the receiver
- * 2) Receive the receiver's public value
- * 3) Encrypt m[0], ..., m[n - 1] using different keys
- * 4) Send the encrypted values
- * You may find `byteblock_to_integer` and `integer_to_byteblock` useful
- * Disconnect and throw errors only for invalid MACs
+ * Send one of m[0], ..., m[n - 1] using OT, where n = m.size().
  */
 void PeerLink::OT_send(std::vector<int> m)
 {
-  // Implement me!
-  auto &mod_inv = CryptoPP::EuclideanMultiplicativeInverse;
-  auto [dh_obj, dh_priv_key, dh_pub_key] = crypto_driver->DH_initialize();
-
-  // 1) Sample a public DH value and send it to the receiver
-  SenderToReceiver_OTPublicValue_Message sender_pub_key_msg;
-  sender_pub_key_msg.public_value = dh_pub_key;
-  std::vector<unsigned char> bytes =
-      crypto_driver->encrypt_and_tag(AES_key, HMAC_key, &sender_pub_key_msg);
-  network_driver->socket_send(socket, bytes);
-
-  // 2) Receive the receiver's public value
-  bytes = network_driver->socket_read(socket);
-  auto [plain_bytes, verified] =
-      crypto_driver->decrypt_and_verify(AES_key, HMAC_key, bytes);
-  if (!verified)
-  {
-    throw std::runtime_error(
-        "OT_send: Received invalid HMAC for receiver's public value");
-  }
-  ReceiverToSender_OTPublicValue_Message receiver_pub_key_msg;
-  receiver_pub_key_msg.deserialize(plain_bytes);
+  OT_send_batch({m});
+}
 
-  // 3) Encrypt m[0], ..., m[n - 1] using different keys
-  CryptoPP::Integer B = byteblock_to_integer(receiver_pub_key_msg.public_value);
-  CryptoPP::Integer A = byteblock_to_integer(dh_pub_key);
-  CryptoPP::Integer a = byteblock_to_integer(dh_priv_key);
+/*
+ * Receive m_c using OT.
+ */
+int PeerLink::OT_recv(int choice_bit)
+{
+  return OT_recv_batch({choice_bit})[0];
+}
 
-  SenderToReceiver_OTEncryptedValues_Message ot_msg;
-  for (int i = 0; i < m.size(); i++)
-  {
-    // HKDF input: (B / A^i)^a
-    CryptoPP::Integer k_i = (B * mod_inv(mod_exp(A, i, DL_P), DL_P)) % DL_P;
+/*
+ * Run m.size() independent 1-out-of-4 OTs on bits at once, where the j-th OT
+ * sends one of m[j][0], ..., m[j][3]. Requires SetupOTExtension.
+ */
+void PeerLink::OT_send_batch(std::vector<std::vector<int>> m)
+{
+  this->ot_driver->OT_extension_send(m);
+}
 
-    auto k_to_hash = crypto_driver->DH_generate_shared_key(
-        dh_obj, dh_priv_key, integer_to_byteblock(k_i));
-    SecByteBlock k = crypto_driver->AES_generate_key(k_to_hash);
-    auto [e, iv] = crypto_driver->AES_encrypt(k, std::to_string(m[i]));
+/*
+ * Receive m[j][choice_bits[j]] for every OT in a batch. Requires
+ * SetupOTExtension.
+ */
+std::vector<int> PeerLink::OT_recv_batch(std::vector<int> choice_bits)
+{
+  return this->ot_driver->OT_extension_recv(choice_bits);
+}
 
-    ot_msg.encryptions.push_back(e);
-    ot_msg.ivs.push_back(iv);
-  }
+/**
+ * Run the base OTs of OT extension with the other party. The OT sender of the
+ * extension acts as the receiver of the base OTs. Must run after key exchange.
+ */
+void PeerLink::SetupOTExtension(bool ot_sender)
+{
+  this->ot_driver = std::make_shared<OTDriver>(
+      this->socket, this->network_driver, this->crypto_driver, this->session);
+  this->ot_sender = ot_sender;
 
-  // 4) Send the encrypted values
-  bytes = crypto_driver->encrypt_and_tag(AES_key, HMAC_key, &ot_msg);
-  network_driver->socket_send(socket, bytes);
+  if (ot_sender)
+  {
+    this->ot_driver->OT_extension_setup_sender();
+  }
+  else
+  {
+    this->ot_driver->OT_extension_setup_receiver();
+  }
 }
 
-/*
- * Receive m_c using OT. This function should:
- * 1) Read the sender's public value
- * 2) Respond with our public value that depends on our choice bit
- * 3) Generate the appropriate key and decrypt the appropriate ciphertext
- * You may find `byteblock_to_integer` and `integer_to_byteblock` useful
- * Disconnect and throw errors only for invalid MACs
+/**
+ * Make num_ots random 1-out-of-4 OTs ahead of time, so that the OTs of later
+ * batches only exchange a few bits each. Both parties must call this with the
+ * same count. Requires SetupOTExtension.
  */
-int PeerLink::OT_recv(int choice_bit)
+void PeerLink::PrecomputeOTs(int num_ots)
 {
-  // Implement me!
-  // 1) Read the sender's public value
-  std::vector<unsigned char> bytes = network_driver->socket_read(socket);
-  auto [plain_bytes, verified] =
-      crypto_driver->decrypt_and_verify(AES_key, HMAC_key, bytes);
-  if (!verified)
+  if (this->ot_sender)
   {
-    throw std::runtime_error(
-        "OT_recv: Received invalid HMAC for sender's public value");
+    this->ot_driver->ROT4_precompute_send(num_ots);
   }
-  SenderToReceiver_OTPublicValue_Message sender_pub_key_msg;
-  sender_pub_key_msg.deserialize(plain_bytes);
-  CryptoPP::Integer A = byteblock_to_integer(sender_pub_key_msg.public_value);
-
-  // 2) Respond with our public value that depends on our choice bit
-  auto [dh_obj, dh_priv_key, dh_pub_key] = crypto_driver->DH_initialize();
-
-  ReceiverToSender_OTPublicValue_Message receiver_pub_key_msg;
-  CryptoPP::Integer B = byteblock_to_integer(dh_pub_key);
-  B = (B * mod_exp(A, choice_bit, DL_P)) % DL_P;
-  dh_pub_key = integer_to_byteblock(B);
-  receiver_pub_key_msg.public_value = dh_pub_key;
-  bytes =
-      crypto_driver->encrypt_and_tag(AES_key, HMAC_key, &receiver_pub_key_msg);
-  network_driver->socket_send(socket, bytes);
-
-  // 3) Generate the appropriate key and decrypt the appropriate ciphertext
-  bytes = network_driver->socket_read(socket);
-  auto [plain_bytes_2, verified_2] =
-      crypto_driver->decrypt_and_verify(AES_key, HMAC_key, bytes);
-  if (!verified)
+  else
   {
-    throw std::runtime_error(
-        "OT_recv: Received invalid HMAC for sender's final message");
+    this->ot_driver->ROT4_precompute_recv(num_ots);
   }
+}
 
-  SenderToReceiver_OTEncryptedValues_Message ot_msg;
-  ot_msg.deserialize(plain_bytes_2);
-  auto kc_to_hash = crypto_driver->DH_generate_shared_key(
-      dh_obj, dh_priv_key, sender_pub_key_msg.public_value);
-  SecByteBlock kc = crypto_driver->AES_generate_key(kc_to_hash);
-
-  auto str = crypto_driver->AES_decrypt(kc, ot_msg.ivs[choice_bit],
-                                        ot_msg.encryptions[choice_bit]);
-
-  return std::stoi(str);
+/**
+ * Return the next n bits of the PRG shared with the other party. Both parties
+ * see the same bits as long as they ask for them in the same order, so each
+ * bit can serve as the non-owner's share of an input wire without being sent.
+ */
+std::vector<int> PeerLink::InputSharingBits(int n)
+{
+  return this->input_prg->generate_bits(n);
 }
 
-void PeerLink::SendSecretShare(int share)
+void PeerLink::SendMaskedShares(std::vector<int> bits)
 {
-  InitialShare_Message msg;
-  msg.share_value = share;
+  MaskedShares_Message msg;
+  msg.bits = bits;
 
-  std::vector<unsigned char> bytes = this->crypto_driver->encrypt_and_tag(this->AES_key, this->HMAC_key, &msg);
-  this->network_driver->socket_send(this->socket, bytes);
+  std::vector<unsigned char> bytes = this->crypto_driver->encrypt_and_tag(
+      *this->session, MessageType::MaskedShares_Message, &msg);
+  this->network_driver->socket_send(this->socket, std::move(bytes),
+                                    MessageType::MaskedShares_Message);
 }
 
-int PeerLink::ReceiveSecretShare()
+std::vector<int> PeerLink::ReceiveMaskedShares()
 {
-  auto bytes = this->network_driver->socket_read(socket);
-  auto [plain_bytes, verified] = crypto_driver->decrypt_and_verify(AES_key, HMAC_key, bytes);
+  auto bytes = this->network_driver->socket_read(
+      socket, MessageType::MaskedShares_Message);
+  auto [plain_bytes, verified] = crypto_driver->decrypt_and_verify(
+      *session, MessageType::MaskedShares_Message, std::move(bytes));
   if (!verified)
   {
-    throw std::runtime_error("Error verifying secret share reception message");
+    throw std::runtime_error("Error verifying masked shares message");
   }
 
-  InitialShare_Message msg;
+  MaskedShares_Message msg;
   msg.deserialize(plain_bytes);
 
-  return msg.share_value;
+  return msg.bits;
 }
 
 void PeerLink::ReadFirstHandleKeyExchange()
@@ -199,7 +253,8 @@ void PeerLink::ReadFirstHandleKeyExchange()
 
   // Listen for g^b
   std::cout << "performing read-first handle key exchange\n";
-  std::vector<unsigned char> garbler_public_value_data = network_driver->socket_read(socket);
+  std::vector<unsigned char> garbler_public_value_data = network_driver->socket_read(
+      socket, MessageType::DHPublicValue_Message);
   std::cout << "done with socket read" << std::endl;
   DHPublicValue_Message garbler_public_value_s;
   garbler_public_value_s.deserialize(garbler_public_value_data);
@@ -209,19 +264,16 @@ void PeerLink::ReadFirstHandleKeyExchange()
   evaluator_public_value_s.public_value = std::get<2>(dh_values);
   std::vector<unsigned char> evaluator_public_value_data;
   evaluator_public_value_s.serialize(evaluator_public_value_data);
-  network_driver->socket_send(socket, evaluator_public_value_data);
+  network_driver->socket_send(socket, std::move(evaluator_public_value_data),
+                              MessageType::DHPublicValue_Message);
 
   // Recover g^ab
   CryptoPP::SecByteBlock DH_shared_key = crypto_driver->DH_generate_shared_key(
       std::get<0>(dh_values), std::get<1>(dh_values),
       garbler_public_value_s.public_value);
-  CryptoPP::SecByteBlock AES_key =
-      this->crypto_driver->AES_generate_key(DH_shared_key);
-  CryptoPP::SecByteBlock HMAC_key =
-      this->crypto_driver->HMAC_generate_key(DH_shared_key);
-
-  this->AES_key = AES_key;
-  this->HMAC_key = HMAC_key;
+  this->session =
+      this->crypto_driver->AEAD_session_initialize(DH_shared_key, false);
+  this->input_prg = this->crypto_driver->PRSS_initialize(DH_shared_key);
 }
 
 /**
@@ -237,11 +289,12 @@ void PeerLink::SendFirstHandleKeyExchange()
   garbler_public_value_s.public_value = std::get<2>(dh_values);
   std::vector<unsigned char> garbler_public_value_data;
   garbler_public_value_s.serialize(garbler_public_value_data);
-  network_driver->socket_send(socket, garbler_public_value_data);
+  network_driver->socket_send(socket, std::move(garbler_public_value_data),
+                              MessageType::DHPublicValue_Message);
 
   // Listen for g^a
   std::vector<unsigned char> evaluator_public_value_data =
-      network_driver->socket_read(socket);
+      network_driver->socket_read(socket, MessageType::DHPublicValue_Message);
   DHPublicValue_Message evaluator_public_value_s;
   evaluator_public_value_s.deserialize(evaluator_public_value_data);
 
@@ -249,11 +302,7 @@ void PeerLink::SendFirstHandleKeyExchange()
   CryptoPP::SecByteBlock DH_shared_key = crypto_driver->DH_generate_shared_key(
       std::get<0>(dh_values), std::get<1>(dh_values),
       evaluator_public_value_s.public_value);
-  CryptoPP::SecByteBlock AES_key =
-      this->crypto_driver->AES_generate_key(DH_shared_key);
-  CryptoPP::SecByteBlock HMAC_key =
-      this->crypto_driver->HMAC_generate_key(DH_shared_key);
-
-  this->AES_key = AES_key;
-  this->HMAC_key = HMAC_key;
+  this->session =
+      this->crypto_driver->AEAD_session_initialize(DH_shared_key, true);
+  this->input_prg = this->crypto_driver->PRSS_initialize(DH_shared_key);
 }
\ No newline at end of file
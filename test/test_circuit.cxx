@@ -0,0 +1,250 @@
+#include "doctest/doctest.h"
+
+#include <cstdio>
+#include <fstream>
+
+#include "../include-shared/bit_vector.hpp"
+#include "../include-shared/circuit.hpp"
+#include "../include-shared/circuit_optimizer.hpp"
+#include "../include-shared/compiled_circuit.hpp"
+#include "../include-shared/gate_stream.hpp"
+
+TEST_CASE("levelize_circuit groups AND gates by multiplicative depth") {
+  // w4 = w0 & w1, w5 = w4 ^ w2, w6 = w5 & w0, plus an independent w7 = w2 & w3
+  Circuit circuit;
+  circuit.num_wire = 8;
+  circuit.input_length = 4;
+  circuit.output_length = 1;
+  circuit.gates = {{GateType::AND_GATE, 0, 1, 4},
+                   {GateType::XOR_GATE, 4, 2, 5},
+                   {GateType::AND_GATE, 5, 0, 6},
+                   {GateType::AND_GATE, 2, 3, 7}};
+  circuit.num_gate = circuit.gates.size();
+
+  LevelizedCircuit levelized = levelize_circuit(circuit);
+  REQUIRE(levelized.layers.size() == 2);
+
+  // Layer 0: no local gates, both depth-0 ANDs.
+  CHECK(levelized.layers[0].and_begin - levelized.layers[0].local_begin == 0);
+  CHECK(levelized.layers[0].end - levelized.layers[0].and_begin == 2);
+
+  // Layer 1: the XOR that consumes the first AND, then the dependent AND.
+  const CircuitLayer &layer = levelized.layers[1];
+  CHECK(layer.and_begin - layer.local_begin == 1);
+  CHECK(levelized.gates[layer.local_begin].type == GateType::XOR_GATE);
+  CHECK(layer.end - layer.and_begin == 1);
+  CHECK(levelized.gates[layer.and_begin].output == 6);
+}
+
+TEST_CASE("assign_wire_slots bounds shares by the circuit width") {
+  // A chain w_{k+2} = w_{k+1} ^ w_k (or AND every third gate) over 2 inputs:
+  // 102 wires, but only three values are ever live at once.
+  Circuit circuit;
+  circuit.num_wire = 102;
+  circuit.input_length = 2;
+  circuit.output_length = 1;
+  for (int k = 0; k < 100; k++) {
+    GateType::T type = k % 3 == 0 ? GateType::AND_GATE : GateType::XOR_GATE;
+    circuit.gates.push_back({type, k + 1, k, k + 2});
+  }
+  circuit.num_gate = circuit.gates.size();
+
+  LevelizedCircuit levelized = levelize_circuit(circuit);
+  int num_slots = assign_wire_slots(levelized, circuit.num_wire,
+                                    circuit.input_length, circuit.output_length);
+  CHECK(num_slots <= 4);
+
+  for (int x = 0; x < 4; x++) {
+    std::vector<int> wires(circuit.num_wire), slots(num_slots);
+    for (int i = 0; i < 2; i++) {
+      wires[i] = slots[i] = (x >> i) & 1;
+    }
+    for (const Gate &g : circuit.gates) {
+      wires[g.output] = g.type == GateType::AND_GATE ? wires[g.lhs] & wires[g.rhs]
+                                                     : wires[g.lhs] ^ wires[g.rhs];
+    }
+    for (const Gate &g : levelized.gates) {
+      slots[g.output] = g.type == GateType::AND_GATE ? slots[g.lhs] & slots[g.rhs]
+                                                     : slots[g.lhs] ^ slots[g.rhs];
+    }
+    CHECK(slots[num_slots - 1] == wires[circuit.num_wire - 1]);
+  }
+}
+
+TEST_CASE("find_gate_runs merges gates over consecutive wires") {
+  std::vector<Gate> gates = {{GateType::XOR_GATE, 0, 8, 16},
+                             {GateType::XOR_GATE, 1, 9, 17},
+                             {GateType::XOR_GATE, 2, 10, 18},
+                             {GateType::XOR_GATE, 16, 3, 19},
+                             {GateType::NOT_GATE, 4, 0, 20}};
+
+  std::vector<GateRun> runs = find_gate_runs(gates, 0, gates.size());
+  REQUIRE(runs.size() == 3);
+  CHECK(runs[0].length == 3);
+  CHECK(runs[1].lhs == 16);
+  CHECK(runs[2].type == GateType::NOT_GATE);
+}
+
+TEST_CASE("BitVector evaluates unaligned XOR runs word by word") {
+  BitVector shares(230);
+  for (int i = 0; i < 70; i++) {
+    shares.set(3 + i, i % 3 == 0);
+    shares.set(75 + i, i % 2 == 0);
+  }
+
+  shares.xor_range(150, 3, 75, 70);
+  for (int i = 0; i < 70; i++) {
+    CHECK(shares.get(150 + i) == ((i % 3 == 0) ^ (i % 2 == 0)));
+  }
+}
+
+TEST_CASE("optimize_circuit merges, folds and drops gates") {
+  // w3 = w0 & w1, w4 = w1 & w0 (duplicate), w5 = w3 ^ w4 (always 0),
+  // w6 = NOT w0, w7 = w6 & w1, w8 = w2 & w2 (dead), w9 = w7 ^ w5, w10 = w3
+  Circuit circuit;
+  circuit.num_wire = 11;
+  circuit.input_length = 3;
+  circuit.output_length = 2;
+  circuit.gates = {{GateType::AND_GATE, 0, 1, 3},  {GateType::AND_GATE, 1, 0, 4},
+                   {GateType::XOR_GATE, 3, 4, 5},  {GateType::NOT_GATE, 0, 0, 6},
+                   {GateType::AND_GATE, 6, 1, 7},  {GateType::AND_GATE, 2, 2, 8},
+                   {GateType::XOR_GATE, 7, 5, 9},  {GateType::XOR_GATE, 3, 5, 10}};
+  circuit.num_gate = circuit.gates.size();
+
+  OptimizerReport report;
+  Circuit optimized = optimize_circuit(circuit, &report);
+  CHECK(report.and_gates_before == 4);
+  // (NOT w0) & w1 = (w0 & w1) ^ w1 reuses the single remaining AND.
+  CHECK(report.and_gates_after == 1);
+  CHECK(optimized.input_length == 3);
+  CHECK(optimized.output_length == 2);
+
+  for (int x = 0; x < 8; x++) {
+    std::vector<int> wires(optimized.num_wire);
+    for (int i = 0; i < 3; i++) {
+      wires[i] = (x >> i) & 1;
+    }
+    for (const Gate &g : optimized.gates) {
+      if (g.type == GateType::AND_GATE) {
+        wires[g.output] = wires[g.lhs] & wires[g.rhs];
+      } else if (g.type == GateType::XOR_GATE) {
+        wires[g.output] = wires[g.lhs] ^ wires[g.rhs];
+      } else {
+        wires[g.output] = 1 - wires[g.lhs];
+      }
+    }
+    int w0 = x & 1, w1 = (x >> 1) & 1;
+    CHECK(wires[optimized.num_wire - 2] == ((1 - w0) & w1));
+    CHECK(wires[optimized.num_wire - 1] == (w0 & w1));
+  }
+}
+
+TEST_CASE("parse_circuit_text reads Bristol Fashion gates") {
+  // Two 2-bit inputs; w4 = w0 ^ w2, MAND w5 = w1 & w0 and w6 = w3 & w2,
+  // w7 = 1, w8 = w4, w9 = w8 & w7.
+  std::string text = "5 10\n"
+                     "2 2 2\n"
+                     "1 3\n"
+                     "\n"
+                     "2 1 0 2 4 XOR\n"
+                     "4 2 1 3 0 2 5 6 MAND\n"
+                     "1 1 1 7 EQ\n"
+                     "1 1 4 8 EQW\n"
+                     "2 1 8 7 9 AND\n";
+  Circuit circuit = parse_circuit_text(text.data(), text.size());
+  CHECK(circuit.input_groups == std::vector<int>{2, 2});
+  CHECK(circuit.output_groups == std::vector<int>{3});
+  CHECK(circuit.input_length == 4);
+  CHECK(circuit.num_and_gate == 3);
+
+  for (int x = 0; x < 16; x++) {
+    std::vector<int> wires(circuit.num_wire);
+    for (int i = 0; i < 4; i++) {
+      wires[i] = (x >> i) & 1;
+    }
+    for (const Gate &g : circuit.gates) {
+      if (g.type == GateType::AND_GATE) {
+        wires[g.output] = wires[g.lhs] & wires[g.rhs];
+      } else if (g.type == GateType::XOR_GATE) {
+        wires[g.output] = wires[g.lhs] ^ wires[g.rhs];
+      } else {
+        wires[g.output] = 1 - wires[g.lhs];
+      }
+    }
+    CHECK(wires[5] == (wires[1] & wires[0]));
+    CHECK(wires[6] == (wires[3] & wires[2]));
+    CHECK(wires[7] == 1);
+    CHECK(wires[9] == (wires[0] ^ wires[2]));
+  }
+}
+
+TEST_CASE("parse_circuit_text rejects malformed circuits") {
+  auto parse = [](std::string text) {
+    return parse_circuit_text(text.data(), text.size());
+  };
+  CHECK_NOTHROW(parse("1 4\n1 1 1\n\n2 1 0 1 3 AND\n"));
+  // Too few gates, wire out of range, wire read before set, wrong arity,
+  // unknown type, extra gates, a bad number, an input wire written, and a
+  // wire written twice, including by EQ and EQW.
+  CHECK_THROWS(parse("2 4\n1 1 1\n\n2 1 0 1 3 AND\n"));
+  CHECK_THROWS(parse("1 4\n1 1 1\n\n2 1 0 4 3 AND\n"));
+  CHECK_THROWS(parse("1 4\n1 1 1\n\n2 1 0 2 3 AND\n"));
+  CHECK_THROWS(parse("1 4\n1 1 1\n\n1 1 0 3 AND\n"));
+  CHECK_THROWS(parse("1 4\n1 1 1\n\n2 1 0 1 3 OR\n"));
+  CHECK_THROWS(parse("1 4\n1 1 1\n\n2 1 0 1 3 AND\n2 1 0 1 2 XOR\n"));
+  CHECK_THROWS(parse("1 4\n1 1 1\n\n2 1 0 1x 3 AND\n"));
+  CHECK_THROWS(parse("1 4\n1 1 1\n\n2 1 0 1 1 AND\n"));
+  CHECK_THROWS(parse("2 4\n1 1 1\n\n2 1 0 1 3 AND\n2 1 0 1 3 XOR\n"));
+  CHECK_THROWS(parse("2 4\n1 1 1\n\n2 1 0 1 3 AND\n1 1 1 3 EQ\n"));
+  CHECK_THROWS(parse("2 4\n1 1 1\n\n2 1 0 1 3 AND\n1 1 0 3 EQW\n"));
+}
+
+TEST_CASE("GateStream yields the same gates as parse_circuit in chunks") {
+  std::string filename = "gate_stream_test.txt";
+  {
+    std::ofstream out(filename);
+    out << "5 10\n2 2 2\n1 1\n\n"
+           "2 1 0 2 4 XOR\n2 1 1 3 5 AND\n1 1 4 6 INV\n"
+           "4 2 5 6 0 1 7 8 MAND\n1 1 8 9 EQW\n";
+  }
+  Circuit circuit = parse_circuit(filename);
+
+  std::vector<Gate> streamed, chunk;
+  {
+    GateStream stream(filename, 2, 1);
+    CHECK(stream.num_wire == 10);
+    CHECK(stream.input_length == 4);
+    CHECK(stream.num_and_gate == -1);
+    while (stream.next(chunk)) {
+      CHECK(chunk.size() <= 3);
+      streamed.insert(streamed.end(), chunk.begin(), chunk.end());
+    }
+  }
+  std::remove(filename.c_str());
+
+  REQUIRE(streamed.size() == circuit.gates.size());
+  for (size_t k = 0; k < streamed.size(); k++) {
+    CHECK(streamed[k].type == circuit.gates[k].type);
+    CHECK(streamed[k].lhs == circuit.gates[k].lhs);
+    CHECK(streamed[k].output == circuit.gates[k].output);
+  }
+}
+
+TEST_CASE("compiled circuits keep their output groups") {
+  std::string text = "3 7\n2 2 2\n2 1 1\n\n"
+                     "2 1 0 2 4 XOR\n2 1 1 3 5 AND\n1 1 4 6 INV\n";
+  Circuit circuit = parse_circuit_text(text.data(), text.size());
+  std::string filename = "compiled_circuit_test.gmw";
+  CompiledCircuit(circuit).write(filename);
+  {
+    CompiledCircuit compiled(filename);
+    CHECK(compiled.output_groups == std::vector<int>{1, 1});
+    CHECK(compiled.num_and_gate == 1);
+    GateStream stream(filename);
+    CHECK(stream.output_groups == std::vector<int>{1, 1});
+    std::vector<Gate> chunk;
+    while (stream.next(chunk)) {
+    }
+  }
+  std::remove(filename.c_str());
+}
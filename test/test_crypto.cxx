@@ -0,0 +1,64 @@
+#include <cstring>
+
+#include "doctest/doctest.h"
+
+#include "../include-shared/messages.hpp"
+#include "../include/drivers/crypto_driver.hpp"
+
+namespace {
+std::vector<unsigned char> encrypt_bits(CryptoDriver &crypto_driver,
+                                        AEADSession &session, int channel,
+                                        std::vector<int> bits) {
+  MaskedShares_Message msg;
+  msg.bits = bits;
+  return crypto_driver.encrypt_and_tag(session, channel, &msg);
+}
+} // namespace
+
+TEST_CASE("AEAD sessions round trip, reject tampering and replays") {
+  CryptoDriver crypto_driver;
+  SecByteBlock shared_key(32);
+  std::memset(shared_key.data(), 7, shared_key.size());
+  auto sender = crypto_driver.AEAD_session_initialize(shared_key, true);
+  auto receiver = crypto_driver.AEAD_session_initialize(shared_key, false);
+
+  SUBCASE("round trip") {
+    for (int i = 0; i < 3; i++) {
+      std::vector<int> bits = {1, 0, 1, 1, i & 1};
+      auto [plaintext, verified] = crypto_driver.decrypt_and_verify(
+          *receiver, 0, encrypt_bits(crypto_driver, *sender, 0, bits));
+      REQUIRE(verified);
+      MaskedShares_Message msg;
+      msg.deserialize(plaintext);
+      CHECK(msg.bits == bits);
+    }
+  }
+
+  SUBCASE("tampered tag") {
+    std::vector<unsigned char> ciphertext =
+        encrypt_bits(crypto_driver, *sender, 0, {1, 0, 1});
+    std::vector<unsigned char> tampered = ciphertext;
+    tampered.back() ^= 1;
+    CHECK_FALSE(crypto_driver.decrypt_and_verify(*receiver, 0, tampered).second);
+    // A rejected message does not advance the counter.
+    CHECK(crypto_driver.decrypt_and_verify(*receiver, 0, ciphertext).second);
+  }
+
+  SUBCASE("replayed nonce") {
+    std::vector<unsigned char> ciphertext =
+        encrypt_bits(crypto_driver, *sender, 0, {1, 0, 1});
+    CHECK(crypto_driver.decrypt_and_verify(*receiver, 0, ciphertext).second);
+    CHECK_FALSE(
+        crypto_driver.decrypt_and_verify(*receiver, 0, ciphertext).second);
+  }
+
+  SUBCASE("channels keep separate counters") {
+    std::vector<unsigned char> first =
+        encrypt_bits(crypto_driver, *sender, 1, {1});
+    std::vector<unsigned char> second =
+        encrypt_bits(crypto_driver, *sender, 2, {0});
+    CHECK_FALSE(crypto_driver.decrypt_and_verify(*receiver, 2, first).second);
+    CHECK(crypto_driver.decrypt_and_verify(*receiver, 2, second).second);
+    CHECK(crypto_driver.decrypt_and_verify(*receiver, 1, first).second);
+  }
+}
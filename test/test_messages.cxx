@@ -0,0 +1,68 @@
+#include "doctest/doctest.h"
+
+#include "../include-shared/messages.hpp"
+
+TEST_CASE("sizes are encoded as varints") {
+  for (size_t n : {(size_t)0, (size_t)127, (size_t)128, (size_t)16384, (size_t)-1}) {
+    std::vector<unsigned char> data;
+    int written = put_size(n, data);
+    CHECK(written == data.size());
+
+    size_t read;
+    CHECK(get_size(&read, data, 0) == written);
+    CHECK(read == n);
+  }
+
+  std::vector<unsigned char> data;
+  CHECK(put_size(127, data) == 1);
+  CHECK(put_size(128, data) == 2);
+}
+
+TEST_CASE("messages round trip through the binary codec") {
+  MaskedShares_Message masked;
+  masked.bits = {1, 0, 1, 1, 0, 0, 0, 1, 1};
+  std::vector<unsigned char> data;
+  masked.serialize(data);
+  // type byte, count, two bytes of packed bits
+  CHECK(data.size() == 4);
+
+  MaskedShares_Message masked_copy;
+  CHECK(masked_copy.deserialize(data) == data.size());
+  CHECK(masked_copy.bits == masked.bits);
+
+  OutputShares_Message outputs;
+  outputs.bits = {0, 1, 1, 0, 1, 0, 0, 1, 1, 1};
+  data.clear();
+  outputs.serialize(data);
+  OutputShares_Message outputs_copy;
+  outputs_copy.deserialize(data);
+  CHECK(outputs_copy.bits == outputs.bits);
+
+  SenderToReceiver_OTEncryptedValuesBatch_Message batch;
+  batch.encryptions = {{"a", "bc"}, {}, {"def"}};
+  batch.ivs = {{CryptoPP::SecByteBlock(16)}, {}, {}};
+  data.clear();
+  batch.serialize(data);
+  SenderToReceiver_OTEncryptedValuesBatch_Message batch_copy;
+  batch_copy.deserialize(data);
+  CHECK(batch_copy.encryptions == batch.encryptions);
+  REQUIRE(batch_copy.ivs.size() == 3);
+  CHECK(batch_copy.ivs[0].size() == 1);
+  CHECK(batch_copy.ivs[0][0].size() == 16);
+}
+
+TEST_CASE("truncated or mistyped messages are rejected") {
+  ReceiverToSender_OTExtensionMatrix_Message matrix;
+  matrix.matrix = std::string(300, 'x');
+  std::vector<unsigned char> data;
+  matrix.serialize(data);
+
+  for (size_t cut = 0; cut < data.size(); cut++) {
+    std::vector<unsigned char> truncated(data.begin(), data.begin() + cut);
+    ReceiverToSender_OTExtensionMatrix_Message copy;
+    CHECK_THROWS(copy.deserialize(truncated));
+  }
+
+  OutputShares_Message outputs;
+  CHECK_THROWS(outputs.deserialize(data));
+}
@@ -0,0 +1,37 @@
+#include "doctest/doctest.h"
+
+#include "../include-shared/prg.hpp"
+#include "../include/pkg/loopback.hpp"
+
+TEST_CASE("OT_extension delivers the chosen bit across a pool top-up") {
+  LoopbackPair loopback;
+  LoopbackParty &sender = loopback.sender, &receiver = loopback.receiver;
+  loopback.both([&] { sender.ot_driver->OT_extension_setup_sender(); },
+                [&] { receiver.ot_driver->OT_extension_setup_receiver(); });
+
+  // The batch takes the 100 precomputed OTs and then tops the pool up, so it
+  // crosses the boundary between the two extension runs.
+  const int num_precomputed = 100, num_ots = 300;
+  loopback.both(
+      [&] { sender.ot_driver->ROT4_precompute_send(num_precomputed); },
+      [&] { receiver.ot_driver->ROT4_precompute_recv(num_precomputed); });
+
+  std::vector<std::vector<int>> m(num_ots);
+  std::vector<int> choices(num_ots);
+  for (int j = 0; j < num_ots; j++) {
+    m[j] = PRG::local().generate_bits(4);
+    choices[j] = (j * 7 + j / 4) & 3;
+  }
+  std::vector<int> received = loopback.both(
+      [&] { sender.ot_driver->OT_extension_send(m); },
+      [&] { return receiver.ot_driver->OT_extension_recv(choices); });
+
+  REQUIRE(received.size() == num_ots);
+  for (int j = 0; j < num_ots; j++) {
+    CHECK(received[j] == m[j][choices[j]]);
+  }
+
+  // Out-of-range choices are rejected before anything is sent.
+  CHECK_THROWS(receiver.ot_driver->OT_extension_recv({0, 4}));
+  CHECK_THROWS(receiver.ot_driver->OT_extension_recv({-1}));
+}
@@ -0,0 +1,49 @@
+#include "doctest/doctest.h"
+
+#include <cstring>
+
+#include "../include-shared/prg.hpp"
+
+TEST_CASE("PRGs with the same seed produce the same stream") {
+  CryptoPP::SecByteBlock seed(16);
+  std::memset(seed.data(), 3, seed.size());
+  PRG a(seed), b(seed);
+
+  // Requests of different sizes, including ones past the buffer, still read
+  // one stream.
+  std::vector<unsigned char> bulk(3 * PRG_BUFFER_SIZE + 5);
+  a.GenerateBlock(bulk.data(), bulk.size());
+  std::vector<unsigned char> pieces(bulk.size());
+  size_t offset = 0;
+  for (size_t n : {(size_t)1, (size_t)100, (size_t)PRG_BUFFER_SIZE + 7}) {
+    b.GenerateBlock(pieces.data() + offset, n);
+    offset += n;
+  }
+  b.GenerateBlock(pieces.data() + offset, pieces.size() - offset);
+  CHECK(bulk == pieces);
+
+  CryptoPP::SecByteBlock other_seed(16);
+  std::memset(other_seed.data(), 4, other_seed.size());
+  PRG c(other_seed);
+  std::vector<unsigned char> other(bulk.size());
+  c.GenerateBlock(other.data(), other.size());
+  CHECK(other != bulk);
+
+  CHECK_THROWS(PRG(CryptoPP::SecByteBlock(8)));
+}
+
+TEST_CASE("PRG bits agree with the words they are drawn from") {
+  CryptoPP::SecByteBlock seed(16);
+  std::memset(seed.data(), 5, seed.size());
+  PRG a(seed), b(seed), c(seed);
+
+  const size_t n = 1000;
+  std::vector<uint64_t> words((n + 63) / 64);
+  a.generate_words(words.data(), words.size());
+  std::vector<int> bits = b.generate_bits(n);
+  REQUIRE(bits.size() == n);
+  for (size_t i = 0; i < n; i++) {
+    CHECK(bits[i] == (int)((words[i / 64] >> (i % 64)) & 1));
+    CHECK(c.generate_bit() == bits[i]);
+  }
+}